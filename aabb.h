@@ -0,0 +1,103 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+// Axis-aligned bounding box, stored as one interval per axis.
+class aabb {
+public:
+  interval x, y, z;
+
+  aabb() {} // The default AABB is empty, since intervals are empty by default.
+
+  aabb(const interval &x, const interval &y, const interval &z)
+      : x(x), y(y), z(z) {}
+
+  aabb(const point3 &a, const point3 &b) {
+    // Treat the two points a and b as extrema for the bounding box, so we
+    // don't require a particular minimum/maximum coordinate order.
+    x = (a[0] <= b[0]) ? interval(a[0], b[0]) : interval(b[0], a[0]);
+    y = (a[1] <= b[1]) ? interval(a[1], b[1]) : interval(b[1], a[1]);
+    z = (a[2] <= b[2]) ? interval(a[2], b[2]) : interval(b[2], a[2]);
+  }
+
+  aabb(const aabb &box0, const aabb &box1) {
+    x = interval(box0.x, box1.x);
+    y = interval(box0.y, box1.y);
+    z = interval(box0.z, box1.z);
+  }
+
+  const interval &axis_interval(int n) const {
+    if (n == 1)
+      return y;
+    if (n == 2)
+      return z;
+    return x;
+  }
+
+  bool is_empty() const {
+    return x.min > x.max || y.min > y.max || z.min > z.max;
+  }
+
+  point3 centroid() const {
+    return point3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max),
+                  0.5 * (z.min + z.max));
+  }
+
+  // Returns the index of the longest axis of the bounding box.
+  int longest_axis() const {
+    if (x.size() > y.size())
+      return x.size() > z.size() ? 0 : 2;
+    else
+      return y.size() > z.size() ? 1 : 2;
+  }
+
+  // Used by the surface area heuristic: the chance that a random ray hitting
+  // a parent box also hits this box is proportional to its surface area.
+  double surface_area() const {
+    if (is_empty())
+      return 0;
+    auto dx = x.size(), dy = y.size(), dz = z.size();
+    return 2 * (dx * dy + dy * dz + dz * dx);
+  }
+
+  bool hit(const ray &r, interval ray_t) const {
+    // Slab test: clip the ray's t range against the pair of planes bounding
+    // each axis in turn. An empty range means the ray misses the box.
+    const point3 &ray_orig = r.origin();
+    const vec3 &ray_dir = r.direction();
+
+    for (int axis = 0; axis < 3; axis++) {
+      const interval &ax = axis_interval(axis);
+      const real adinv = 1 / ray_dir[axis];
+
+      auto t0 = (ax.min - ray_orig[axis]) * adinv;
+      auto t1 = (ax.max - ray_orig[axis]) * adinv;
+
+      if (t0 < t1) {
+        if (t0 > ray_t.min)
+          ray_t.min = t0;
+        if (t1 < ray_t.max)
+          ray_t.max = t1;
+      } else {
+        if (t1 > ray_t.min)
+          ray_t.min = t1;
+        if (t0 < ray_t.max)
+          ray_t.max = t0;
+      }
+
+      if (ray_t.max <= ray_t.min)
+        return false;
+    }
+    return true;
+  }
+
+  static const aabb empty, universe;
+};
+
+const aabb aabb::empty =
+    aabb(interval::empty, interval::empty, interval::empty);
+const aabb aabb::universe =
+    aabb(interval::universe, interval::universe, interval::universe);
+
+#endif // !AABB_H
@@ -0,0 +1,75 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include "arena.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Debug counter of heap allocations. Building with
+// -DRTWEEKEND_COUNT_ALLOCATIONS replaces the global operator new with one that
+// counts every call, and the camera reports how many heap and arena
+// allocations happened while rendering. Without the macro nothing is replaced
+// and the counts stay at zero.
+//
+// Like write_color, the replacement operators are defined in this header, so
+// it may only be included from one translation unit, which is all the
+// renderer is.
+struct allocation_counts {
+  uint64_t heap;
+  uint64_t arena;
+  uint64_t arena_blocks;
+
+  static std::atomic<uint64_t> &heap_allocations() {
+    static std::atomic<uint64_t> n{0};
+    return n;
+  }
+
+  static allocation_counts now() {
+    return {heap_allocations().load(), arena::allocations().load(),
+            arena::block_allocations().load()};
+  }
+
+  allocation_counts operator-(const allocation_counts &since) const {
+    return {heap - since.heap, arena - since.arena,
+            arena_blocks - since.arena_blocks};
+  }
+};
+
+#ifdef RTWEEKEND_COUNT_ALLOCATIONS
+void *operator new(std::size_t size) {
+  allocation_counts::heap_allocations().fetch_add(1,
+                                                  std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+  allocation_counts::heap_allocations().fetch_add(1,
+                                                  std::memory_order_relaxed);
+  auto a = std::size_t(align);
+  if (void *p = std::aligned_alloc(a, (size + a - 1) / a * a))
+    return p;
+  throw std::bad_alloc();
+}
+
+// GCC cannot tell that operator new is the malloc above once this is inlined.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#endif // !ALLOC_COUNTER_H
@@ -0,0 +1,216 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "camera.h"
+#include "flat_bvh.h"
+#include "light_list.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Values keyed by time. Between two keys the value is interpolated linearly;
+// before the first and after the last key it holds.
+template <typename T> class track {
+public:
+  void add(double time, const T &value) {
+    keys.insert(std::upper_bound(keys.begin(), keys.end(), time, before),
+                {time, value});
+  }
+
+  bool empty() const { return keys.empty(); }
+  double start() const { return keys.front().first; }
+  double end() const { return keys.back().first; }
+
+  T at(double time) const {
+    auto next = std::upper_bound(keys.begin(), keys.end(), time, before);
+    if (next == keys.begin())
+      return next->second;
+    if (next == keys.end())
+      return keys.back().second;
+    auto prev = next - 1;
+    double s = (time - prev->first) / (next->first - prev->first);
+    return prev->second + (next->second - prev->second) * s;
+  }
+
+private:
+  using key = std::pair<double, T>;
+  std::vector<key> keys; // Sorted by time.
+
+  static bool before(double time, const key &k) { return time < k.first; }
+};
+
+// A camera path and sphere motion over time, for rendering a sequence of
+// frames of one scene. Camera keys set lookfrom, lookat, vfov and focus_dist
+// together; every other camera setting stays as it is. Moving spheres have
+// their own keys, and the frames are spread evenly from the first key of
+// any track to the last.
+class animation {
+public:
+  track<point3> lookfrom, lookat;
+  track<double> vfov, focus_dist;
+
+  struct sphere_track {
+    sphere *target;
+    track<point3> center;
+  };
+  std::vector<sphere_track> spheres;
+
+  void add_camera_key(double time, const point3 &from, const point3 &at,
+                      double fov, double focus) {
+    lookfrom.add(time, from);
+    lookat.add(time, at);
+    vfov.add(time, fov);
+    focus_dist.add(time, focus);
+  }
+
+  void add_sphere_key(sphere *target, double time, const point3 &center) {
+    auto found = std::find_if(
+        spheres.begin(), spheres.end(),
+        [target](const sphere_track &s) { return s.target == target; });
+    if (found == spheres.end())
+      found = spheres.insert(spheres.end(), {target, {}});
+    found->center.add(time, center);
+  }
+
+  // One full orbit of cam's lookfrom around its lookat, about the vup axis,
+  // with one key per frame so every frame lies exactly on the circle.
+  static animation turntable(const camera &cam, int frames) {
+    animation a;
+    vec3 axis = unit_vector(cam.vup);
+    vec3 arm = cam.lookfrom - cam.lookat;
+    vec3 along = dot(arm, axis) * axis;
+    vec3 x = arm - along;
+    vec3 y = cross(axis, x);
+    for (int f = 0; f < frames; f++) {
+      double angle = 2 * pi * f / frames;
+      point3 from = cam.lookat + along + std::cos(angle) * x +
+                    std::sin(angle) * y;
+      a.add_camera_key(f, from, cam.lookat, cam.vfov, cam.focus_dist);
+    }
+    return a;
+  }
+
+  bool has_camera_path() const { return !lookfrom.empty(); }
+  bool moves_spheres() const { return !spheres.empty(); }
+
+  // Time of frame f of frames.
+  double frame_time(int f, int frames) const {
+    double start = infinity, end = -infinity;
+    auto span = [&](double s, double e) {
+      start = std::min(start, s);
+      end = std::max(end, e);
+    };
+    if (has_camera_path())
+      span(lookfrom.start(), lookfrom.end());
+    for (const auto &s : spheres)
+      span(s.center.start(), s.center.end());
+    if (start > end)
+      return 0;
+    return frames > 1 ? start + (end - start) * f / (frames - 1) : start;
+  }
+
+  // Sets the view of cam and moves the spheres to where they are at time.
+  void apply(double time, camera &cam) const {
+    if (has_camera_path()) {
+      cam.lookfrom = lookfrom.at(time);
+      cam.lookat = lookat.at(time);
+      cam.vfov = vfov.at(time);
+      cam.focus_dist = focus_dist.at(time);
+    }
+    for (const auto &s : spheres)
+      s.target->move_to(s.center.at(time));
+  }
+};
+
+// Replaces the run of '#' in pattern with the zero padded frame number, e.g.
+// frame_####.ppm becomes frame_0007.ppm. Without a '#' the number goes
+// before the extension.
+inline std::string frame_path(const std::string &pattern, int frame) {
+  auto first = pattern.find('#');
+  if (first == std::string::npos) {
+    auto dot = pattern.rfind('.');
+    auto cut = dot == std::string::npos ? pattern.size() : dot;
+    return pattern.substr(0, cut) + "_" + std::to_string(frame) +
+           pattern.substr(cut);
+  }
+  auto last = pattern.find_first_not_of('#', first);
+  if (last == std::string::npos)
+    last = pattern.size();
+  std::string number = std::to_string(frame);
+  if (number.size() < last - first)
+    number.insert(0, last - first - number.size(), '0');
+  return pattern.substr(0, first) + number + pattern.substr(last);
+}
+
+// Renders frames of the animation with one camera and one tree, to the
+// numbered paths of pattern (see frame_path). Sphere motion is applied to the
+// objects the tree was built from, followed by a refit; lights taken from
+// those spheres follow them. Prints the time and throughput of every frame,
+// and the totals amortized over the sequence including setup_seconds, the
+// time spent loading the scene and building the tree before the first frame.
+// False if a frame could not be refit. A camera checkpoint_path is numbered
+// like the frames, so every frame resumes only its own checkpoint: the
+// checkpoint's settings hash covers the camera but not the spheres that
+// moved.
+inline bool render_animation(const animation &anim, int frames, camera &cam,
+                             flat_bvh &scene, const light_list &lights,
+                             const std::string &pattern,
+                             double setup_seconds) {
+  using seconds = std::chrono::duration<double>;
+  auto start = std::chrono::steady_clock::now();
+  double refit_seconds = 0, render_seconds = 0;
+  uint64_t samples = 0, rays = 0;
+  const std::string checkpoint_pattern = cam.checkpoint_path;
+
+  for (int f = 0; f < frames; f++) {
+    auto frame_start = std::chrono::steady_clock::now();
+    anim.apply(anim.frame_time(f, frames), cam);
+    if (anim.moves_spheres() && !scene.refit()) {
+      std::clog << "This scene cannot be refit, spheres cannot move\n";
+      cam.checkpoint_path = checkpoint_pattern;
+      return false;
+    }
+    seconds refit = std::chrono::steady_clock::now() - frame_start;
+
+    cam.output_path = frame_path(pattern, f);
+    if (!checkpoint_pattern.empty())
+      cam.checkpoint_path = frame_path(checkpoint_pattern, f);
+    cam.render(scene, lights);
+    const auto &frame = cam.last_render();
+    refit_seconds += refit.count();
+    render_seconds += frame.seconds;
+    samples += frame.samples;
+    rays += frame.rays;
+
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "Frame %d/%d: %s, %.3f s, %.3f Msamples/s, %.3f Mrays/s, "
+                  "refit %.3f ms\n",
+                  f + 1, frames, cam.output_path.c_str(), frame.seconds,
+                  frame.samples / frame.seconds * 1e-6,
+                  frame.rays / frame.seconds * 1e-6, refit.count() * 1e3);
+    std::clog << line;
+  }
+  cam.checkpoint_path = checkpoint_pattern;
+
+  seconds elapsed = std::chrono::steady_clock::now() - start;
+  double total = elapsed.count() + setup_seconds;
+  char line[512];
+  std::snprintf(line, sizeof(line),
+                "%d frames in %.3f s (setup %.3f s, rendering %.3f s, refit "
+                "%.3f ms): %.3f s/frame, amortized %.3f Msamples/s, "
+                "%.3f Mrays/s\n",
+                frames, total, setup_seconds, render_seconds,
+                refit_seconds * 1e3, total / frames, samples / total * 1e-6,
+                rays / total * 1e-6);
+  std::clog << line;
+  return true;
+}
+
+#endif // !ANIMATION_H
@@ -0,0 +1,215 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Monotonic bump allocator. Memory is handed out from large blocks in
+// allocation order and is only given back all at once: when the arena is
+// destroyed, reset, or rewound to an earlier mark. Objects with destructors
+// are destroyed then too, newest first.
+//
+// Two uses in the renderer:
+//   - The scene arena owns primitives, materials and BVH nodes, so a scene is
+//     a few contiguous blocks instead of hundreds of scattered heap objects,
+//     freed in one go. make() hands out non-owning shared_ptrs, so existing
+//     shared_ptr based code works unchanged; the arena has to outlive them.
+//   - Each thread has a frame arena (arena::frame()) for transient per-tile
+//     buffers. A tile renderer opens an arena::scope and everything allocated
+//     under it is rewound when the scope closes; the blocks stay, so once the
+//     first tiles have warmed it up rendering allocates nothing.
+class arena {
+public:
+  static constexpr size_t default_block_size = 64 * 1024;
+
+  explicit arena(size_t block_size = default_block_size)
+      : block_size(block_size) {}
+
+  arena(const arena &) = delete;
+  arena &operator=(const arena &) = delete;
+
+  ~arena() {
+    reset();
+    for (auto &b : blocks)
+      ::operator delete(b.data);
+  }
+
+  void *allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+    while (current < blocks.size()) {
+      auto &b = blocks[current];
+      auto base = uintptr_t(b.data);
+      size_t start = ((base + b.used + align - 1) & ~(align - 1)) - base;
+      if (start + bytes <= b.size) {
+        b.used = start + bytes;
+        count_allocation(bytes);
+        return b.data + start;
+      }
+      // Later blocks are only ever empty here, try the next one.
+      if (++current < blocks.size())
+        blocks[current].used = 0;
+    }
+    add_block(bytes + align);
+    return allocate(bytes, align);
+  }
+
+  // Constructs a T in the arena. The arena destroys it, never the caller.
+  template <typename T, typename... Args> T *create(Args &&...args) {
+    void *memory = allocate(sizeof(T), alignof(T));
+    T *object = new (memory) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      auto *d = static_cast<destructor *>(
+          allocate(sizeof(destructor), alignof(destructor)));
+      d->destroy = [](void *p) { static_cast<T *>(p)->~T(); };
+      d->object = object;
+      d->next = destructors;
+      destructors = d;
+    }
+    return object;
+  }
+
+  // Like create(), as a shared_ptr for code that takes one. The pointer does
+  // not own the object and has no reference count, so copying it is free;
+  // the object lives exactly as long as the arena. (Sharing a count with the
+  // arena instead would make every arena object that holds a pointer to
+  // another one keep the arena alive forever.)
+  template <typename T, typename... Args>
+  std::shared_ptr<T> make(Args &&...args) {
+    return std::shared_ptr<T>(std::shared_ptr<void>(),
+                              create<T>(std::forward<Args>(args)...));
+  }
+
+  // A position to rewind to.
+  struct marker {
+    size_t block;
+    size_t used;
+    void *destructors;
+  };
+
+  marker mark() const {
+    if (current >= blocks.size())
+      return {current, 0, destructors};
+    return {current, blocks[current].used, destructors};
+  }
+
+  // Destroys everything created since m was taken and reuses its memory.
+  void rewind(const marker &m) {
+    auto *stop = static_cast<destructor *>(m.destructors);
+    while (destructors != stop) {
+      destructors->destroy(destructors->object);
+      destructors = destructors->next;
+    }
+    current = m.block;
+    if (current < blocks.size())
+      blocks[current].used = m.used;
+  }
+
+  void reset() { rewind({0, 0, nullptr}); }
+
+  // Rewinds an arena to where it was when the scope was opened.
+  class scope {
+  public:
+    explicit scope(arena &a) : a(a), m(a.mark()) {}
+    ~scope() { a.rewind(m); }
+    scope(const scope &) = delete;
+    scope &operator=(const scope &) = delete;
+
+  private:
+    arena &a;
+    marker m;
+  };
+
+  // This thread's arena for transient data.
+  static arena &frame() {
+    thread_local arena a(1 << 20);
+    return a;
+  }
+
+  size_t bytes_reserved() const {
+    size_t total = 0;
+    for (const auto &b : blocks)
+      total += b.size;
+    return total;
+  }
+
+  // Process-wide counts for the allocation report (see alloc_counter.h).
+  // Single allocations are only counted with RTWEEKEND_COUNT_ALLOCATIONS.
+  static std::atomic<uint64_t> &allocations() {
+    static std::atomic<uint64_t> n{0};
+    return n;
+  }
+  static std::atomic<uint64_t> &block_allocations() {
+    static std::atomic<uint64_t> n{0};
+    return n;
+  }
+
+private:
+  struct block {
+    unsigned char *data;
+    size_t size;
+    size_t used;
+  };
+
+  struct destructor {
+    void (*destroy)(void *);
+    void *object;
+    destructor *next;
+  };
+
+  size_t block_size;
+  std::vector<block> blocks;
+  size_t current = 0; // Block being allocated from; later ones are unused.
+  destructor *destructors = nullptr;
+
+  void add_block(size_t min_bytes) {
+    size_t size = std::max(block_size, min_bytes);
+    auto *data = static_cast<unsigned char *>(::operator new(size));
+    // Keep the blocks after current for reuse, put the new one right here.
+    blocks.insert(blocks.begin() + current, {data, size, 0});
+    block_allocations()++;
+  }
+
+  static void count_allocation(size_t) {
+#ifdef RTWEEKEND_COUNT_ALLOCATIONS
+    allocations().fetch_add(1, std::memory_order_relaxed);
+#endif
+  }
+};
+
+// Standard allocator over an arena, for containers of transient data.
+// Deallocation does nothing; the memory comes back when the arena rewinds.
+template <typename T> class arena_allocator {
+public:
+  using value_type = T;
+
+  arena_allocator(arena &a) : a(&a) {}
+  template <typename U>
+  arena_allocator(const arena_allocator<U> &other) : a(other.a) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(a->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *, size_t) {}
+
+  template <typename U> bool operator==(const arena_allocator<U> &o) const {
+    return a == o.a;
+  }
+  template <typename U> bool operator!=(const arena_allocator<U> &o) const {
+    return a != o.a;
+  }
+
+private:
+  template <typename U> friend class arena_allocator;
+  arena *a;
+};
+
+template <typename T>
+using arena_vector = std::vector<T, arena_allocator<T>>;
+
+#endif // !ARENA_H
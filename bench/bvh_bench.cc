@@ -0,0 +1,94 @@
+// Rays/sec of a linear hittable_list scan, a linear SIMD sphere_soup scan, a
+// bvh_node and a flat_bvh (with sphere_soup leaves) over the same random
+// sphere scene, for growing object counts.
+//
+//   g++ -std=c++17 -O2 -I.. bvh_bench.cc -o bvh_bench && ./bvh_bench
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "flat_bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "sphere_soup.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+static hittable_list random_spheres(int count) {
+  // Spheres of similar size spread through a cube whose volume grows with the
+  // object count, so the density (and depth complexity) stays constant.
+  hittable_list list;
+  auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+  auto extent = std::cbrt(double(count)) * 2.0;
+  for (int i = 0; i < count; i++) {
+    auto center = vec3::random(-extent, extent);
+    list.add(make_shared<sphere>(center, random_double(0.2, 0.6), mat));
+  }
+  return list;
+}
+
+static std::vector<ray> random_rays(int count, double extent) {
+  std::vector<ray> rays;
+  for (int i = 0; i < count; i++) {
+    auto origin = vec3::random(-extent, extent);
+    rays.emplace_back(origin, random_unit_vector());
+  }
+  return rays;
+}
+
+// Traces the rays repeatedly for at least min_seconds and returns rays/sec.
+static double measure(const hittable &world, const std::vector<ray> &rays,
+                      double min_seconds, size_t &hits) {
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  size_t traced = 0;
+  double elapsed = 0;
+  do {
+    size_t pass_hits = 0;
+    for (const auto &r : rays) {
+      hit_record rec;
+      pass_hits += world.hit(r, interval(0.001, infinity), rec);
+    }
+    hits = pass_hits;
+    traced += rays.size();
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  } while (elapsed < min_seconds);
+  return traced / elapsed;
+}
+
+int main() {
+  seed_random(1);
+
+  std::printf("%10s %14s %14s %14s %14s %9s\n", "objects", "linear ray/s",
+              "soup ray/s", "bvh ray/s", "flat ray/s", "speedup");
+  for (int count : {10, 100, 1000, 10000, 100000}) {
+    auto list = random_spheres(count);
+    auto rays = random_rays(count >= 10000 ? 2000 : 20000,
+                            std::cbrt(double(count)) * 2.0);
+
+    using clock = std::chrono::steady_clock;
+    auto build_start = clock::now();
+    bvh_node bvh(list);
+    auto build_ms = std::chrono::duration<double, std::milli>(clock::now() -
+                                                              build_start)
+                        .count();
+
+    flat_bvh flat(list);
+    sphere_soup soup(list);
+
+    size_t linear_hits, soup_hits, bvh_hits, flat_hits;
+    auto linear = measure(list, rays, 0.5, linear_hits);
+    auto simd = measure(soup, rays, 0.5, soup_hits);
+    auto tree = measure(bvh, rays, 0.5, bvh_hits);
+    auto packed = measure(flat, rays, 0.5, flat_hits);
+
+    bool match = linear_hits == soup_hits && linear_hits == bvh_hits &&
+                 linear_hits == flat_hits;
+    std::printf("%10d %14.0f %14.0f %14.0f %14.0f %8.1fx   (build %.1f ms%s)\n",
+                count, linear, simd, tree, packed, packed / linear, build_ms,
+                match ? "" : ", HIT MISMATCH");
+  }
+}
@@ -0,0 +1,203 @@
+// Closest-hit throughput of hittable_list and bvh_node over the book's final
+// scene, on one thread and on several threads tracing at once. Every hit hands
+// a material to the hit_record, so this is where shared_ptr reference counting
+// on the (shared, heavily hit) materials used to show up.
+//
+// Then the occlusion queries (hittable::occluded) against closest hits on
+// one thread, for every structure including flat_bvh, with shadow rays from
+// points on the ground towards a light above the scene, one at a time and
+// through occluded_batch. The last rows trace a flat_bvh over a
+// triangle_mesh of the same scene, each sphere but the ground an octahedron.
+//
+//   g++ -std=c++17 -O2 -pthread -I.. hit_path_bench.cc -o hit_path_bench
+//   ./hit_path_bench [threads]
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "flat_bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "thread_pool.h"
+#include "triangle_mesh.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+static hittable_list book_scene() {
+  hittable_list world;
+  auto ground = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+  world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground));
+
+  shared_ptr<material> diffuse =
+      make_shared<lambertian>(color(0.4, 0.2, 0.1));
+  shared_ptr<material> glass = make_shared<dielectric>(1.5);
+  for (int a = -11; a < 11; a++) {
+    for (int b = -11; b < 11; b++) {
+      point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+      world.add(make_shared<sphere>(center, 0.2,
+                                    random_double() < 0.8 ? diffuse : glass));
+    }
+  }
+  world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, glass));
+  world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, diffuse));
+  return world;
+}
+
+// The scene's spheres, but the ground, as octahedra with the same centers
+// and radii.
+static void add_octahedra(const hittable_list &world, triangle_mesh &mesh) {
+  static const int faces[8][3] = {{0, 2, 4}, {2, 1, 4}, {1, 3, 4},
+                                  {3, 0, 4}, {2, 0, 5}, {1, 2, 5},
+                                  {3, 1, 5}, {0, 3, 5}};
+  for (const auto &object : world.objects) {
+    auto &s = static_cast<const sphere &>(*object);
+    if (s.radius() > 100)
+      continue;
+    point3 c = s.center();
+    double r = s.radius();
+    uint32_t v[6] = {mesh.add_vertex(c + vec3(r, 0, 0)),
+                     mesh.add_vertex(c - vec3(r, 0, 0)),
+                     mesh.add_vertex(c + vec3(0, r, 0)),
+                     mesh.add_vertex(c - vec3(0, r, 0)),
+                     mesh.add_vertex(c + vec3(0, 0, r)),
+                     mesh.add_vertex(c - vec3(0, 0, r))};
+    for (const auto &f : faces)
+      mesh.add_triangle(v[f[0]], v[f[1]], v[f[2]]);
+  }
+}
+
+// Rays from around the camera position towards the scene.
+static std::vector<ray> camera_rays(int count) {
+  std::vector<ray> rays;
+  for (int i = 0; i < count; i++) {
+    auto origin = point3(13, 2, 3) + vec3::random(-0.5, 0.5);
+    auto target = point3(random_double(-10, 10), random_double(-1, 1),
+                         random_double(-6, 6));
+    rays.emplace_back(origin, unit_vector(target - origin));
+  }
+  return rays;
+}
+
+// Every thread traces all rays, repeatedly, for at least min_seconds.
+// Returns the total rays/sec over all threads.
+static double measure(const hittable &world, const std::vector<ray> &rays,
+                      int threads, double min_seconds) {
+  using clock = std::chrono::steady_clock;
+  std::vector<size_t> traced(threads, 0);
+  std::vector<std::thread> workers;
+  auto start = clock::now();
+  for (int k = 0; k < threads; k++) {
+    workers.emplace_back([&, k] {
+      size_t hits = 0;
+      do {
+        for (const auto &r : rays) {
+          hit_record rec;
+          hits += world.hit(r, interval(0.001, infinity), rec);
+        }
+        traced[k] += rays.size();
+      } while (std::chrono::duration<double>(clock::now() - start).count() <
+               min_seconds);
+      if (hits == 0)
+        std::printf("no hits?\n");
+    });
+  }
+  for (auto &worker : workers)
+    worker.join();
+  double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  size_t total = 0;
+  for (auto n : traced)
+    total += n;
+  return total / elapsed;
+}
+
+// Segments from random points on the ground to a point light above the
+// scene, with the interval that ends just short of the light.
+static std::vector<ray> shadow_rays(int count) {
+  std::vector<ray> rays;
+  const point3 light(2, 8, 1);
+  for (int i = 0; i < count; i++) {
+    point3 p(random_double(-11, 11), 0, random_double(-11, 11));
+    rays.emplace_back(p, light - p);
+  }
+  return rays;
+}
+
+enum class query { closest, occluded, batch };
+
+// Shadow rays per second on this thread, over at least min_seconds, and the
+// number of rays blocked in the last round.
+static double measure_shadows(const hittable &world,
+                              const std::vector<ray> &rays, query q,
+                              double min_seconds, size_t &blocked_count) {
+  using clock = std::chrono::steady_clock;
+  std::vector<interval> ray_t(rays.size(), interval(0.001, 0.999));
+  std::unique_ptr<bool[]> blocked(new bool[rays.size()]);
+  size_t traced = 0;
+  auto start = clock::now();
+  do {
+    if (q == query::batch) {
+      world.occluded_batch(rays.data(), ray_t.data(), rays.size(),
+                           blocked.get());
+    } else {
+      for (size_t k = 0; k < rays.size(); k++) {
+        hit_record rec;
+        blocked[k] = q == query::occluded ? world.occluded(rays[k], ray_t[k])
+                                          : world.hit(rays[k], ray_t[k], rec);
+      }
+    }
+    traced += rays.size();
+  } while (std::chrono::duration<double>(clock::now() - start).count() <
+           min_seconds);
+  double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  blocked_count = 0;
+  for (size_t k = 0; k < rays.size(); k++)
+    blocked_count += blocked[k];
+  return traced / elapsed;
+}
+
+int main(int argc, char **argv) {
+  seed_random(1);
+  int threads = argc > 1 ? std::atoi(argv[1])
+                         : thread_pool::default_thread_count();
+
+  auto list = book_scene();
+  bvh_node bvh(list);
+  auto rays = camera_rays(20000);
+
+  std::printf("%-14s %8s %14s\n", "structure", "threads", "Mrays/s");
+  for (int n : {1, threads}) {
+    std::printf("%-14s %8d %14.3f\n", "hittable_list", n,
+                measure(list, rays, n, 1.0) * 1e-6);
+    std::printf("%-14s %8d %14.3f\n", "bvh_node", n,
+                measure(bvh, rays, n, 1.0) * 1e-6);
+  }
+
+  flat_bvh flat(list);
+  triangle_mesh mesh(make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+  add_octahedra(list, mesh);
+  flat_bvh mesh_tree(mesh);
+  auto shadows = shadow_rays(20000);
+  const char *query_names[] = {"closest hit", "occluded", "occluded_batch"};
+  std::printf("\n%-14s %-16s %14s %10s\n", "structure", "shadow query",
+              "Mrays/s", "blocked");
+  struct named {
+    const char *name;
+    const hittable *world;
+  };
+  for (auto s : {named{"hittable_list", &list}, named{"bvh_node", &bvh},
+                 named{"flat_bvh", &flat},
+                 named{"mesh flat_bvh", &mesh_tree}}) {
+    for (auto q : {query::closest, query::occluded, query::batch}) {
+      size_t blocked = 0;
+      double rate = measure_shadows(*s.world, shadows, q, 1.0, blocked);
+      std::printf("%-14s %-16s %14.3f %10zu\n", s.name, query_names[int(q)],
+                  rate * 1e-6, blocked);
+    }
+  }
+}
@@ -0,0 +1,150 @@
+// Instancing against copying: a cluster of spheres repeated many times, once
+// as instances of one shared cluster tree under a top-level tree, once as
+// every sphere copied out into one flat tree. Prints the build time, the
+// memory each scene adds to the process, and closest-hit throughput; both
+// scenes must hit the same rays at (nearly) the same distances.
+//
+//   g++ -std=c++17 -O2 -I.. instance_bench.cc -o instance_bench
+//   ./instance_bench [spheres per cluster] [clusters] [--no-flat]
+
+#include "rtweekend.h"
+
+#include "arena.h"
+#include "flat_bvh.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using seconds = std::chrono::duration<double>;
+
+// Resident set size in bytes, from /proc (0 where that does not exist).
+static double resident_bytes() {
+  std::FILE *in = std::fopen("/proc/self/statm", "r");
+  if (!in)
+    return 0;
+  long pages = 0, resident = 0;
+  if (std::fscanf(in, "%ld %ld", &pages, &resident) != 2)
+    resident = 0;
+  std::fclose(in);
+  return double(resident) * 4096;
+}
+
+struct placement {
+  affine_transform to_world;
+  double scale;
+};
+
+// Clusters stand on a square grid, each turned and scaled at random.
+static std::vector<placement> placements(int clusters) {
+  std::vector<placement> out;
+  int side = int(std::ceil(std::sqrt(double(clusters))));
+  for (int k = 0; k < clusters; k++) {
+    double scale = random_double(0.8, 1.2);
+    vec3 offset(1.5 * (k % side), 0, 1.5 * (k / side));
+    auto to_world =
+        affine_transform::translate(offset) *
+        affine_transform::rotate(vec3(0, 1, 0), random_double(0, 360)) *
+        affine_transform::scale(scale);
+    out.push_back({to_world, scale});
+  }
+  return out;
+}
+
+// How many of a fixed set of downward rays hit, and the sum of their hit
+// distances, plus the time they took.
+struct trace_result {
+  int hits = 0;
+  double t_sum = 0;
+  double seconds = 0;
+};
+
+static trace_result trace(const hittable &world, int clusters) {
+  double side = 1.5 * std::ceil(std::sqrt(double(clusters)));
+  const int n = 200000;
+  trace_result result;
+  seed_random(7);
+  auto start = std::chrono::steady_clock::now();
+  for (int k = 0; k < n; k++) {
+    point3 origin(random_double(-1, side), 4, random_double(-1, side));
+    vec3 direction(random_double(-0.3, 0.3), -1, random_double(-0.3, 0.3));
+    hit_record rec;
+    if (world.hit(ray(origin, direction), interval(0.001, infinity), rec)) {
+      result.hits++;
+      result.t_sum += rec.t;
+    }
+  }
+  result.seconds = seconds(std::chrono::steady_clock::now() - start).count();
+  return result;
+}
+
+static void print(const char *name, double build_seconds, double bytes,
+                  const trace_result &r) {
+  std::printf("%-10s %10.3f %12.1f %10d %14.4f %10.3f\n", name,
+              build_seconds, bytes / (1 << 20), r.hits, r.t_sum,
+              200000 / r.seconds * 1e-6);
+}
+
+int main(int argc, char **argv) {
+  int per_cluster = argc > 1 ? std::atoi(argv[1]) : 1000;
+  int clusters = argc > 2 ? std::atoi(argv[2]) : 1000;
+  bool flat = !(argc > 3 && !std::strcmp(argv[3], "--no-flat"));
+
+  arena materials;
+  std::vector<shared_ptr<material>> palette;
+  for (int k = 0; k < 8; k++)
+    palette.push_back(materials.make<lambertian>(color::random()));
+
+  seed_random(1);
+  std::vector<point3> centers;
+  for (int k = 0; k < per_cluster; k++)
+    centers.push_back(point3(random_double(-0.5, 0.5), random_double(0, 1),
+                             random_double(-0.5, 0.5)));
+  const double radius = 0.04;
+  auto where = placements(clusters);
+
+  std::printf("%d clusters of %d spheres: %.0f spheres\n", clusters,
+              per_cluster, double(clusters) * per_cluster);
+  std::printf("%-10s %10s %12s %10s %14s %10s\n", "scene", "build s", "MB",
+              "hits", "sum of t", "Mrays/s");
+
+  {
+    double before = resident_bytes();
+    auto start = std::chrono::steady_clock::now();
+    arena scene_arena;
+    hittable_list cluster;
+    for (int k = 0; k < per_cluster; k++)
+      cluster.add(scene_arena.make<sphere>(centers[k], radius,
+                                           palette[k % palette.size()]));
+    auto cluster_tree = std::make_shared<flat_bvh>(cluster);
+    hittable_list instances;
+    for (const auto &p : where)
+      instances.add(scene_arena.make<instance>(cluster_tree, p.to_world));
+    flat_bvh top(instances);
+    double build = seconds(std::chrono::steady_clock::now() - start).count();
+    print("instanced", build, resident_bytes() - before, trace(top, clusters));
+  }
+
+  if (flat) {
+    double before = resident_bytes();
+    auto start = std::chrono::steady_clock::now();
+    arena scene_arena;
+    hittable_list world;
+    for (const auto &p : where)
+      for (int k = 0; k < per_cluster; k++)
+        world.add(scene_arena.make<sphere>(p.to_world.apply_point(centers[k]),
+                                           radius * p.scale,
+                                           palette[k % palette.size()]));
+    flat_bvh tree(world);
+    double build = seconds(std::chrono::steady_clock::now() - start).count();
+    print("flat", build, resident_bytes() - before, trace(tree, clusters));
+  }
+}
@@ -0,0 +1,262 @@
+// Regression benchmark for the core kernels, plus a correctness gate.
+//
+// Times sphere::hit, hittable_list::hit over the book's final scene, each
+// built-in material's scatter, random_unit_vector and random_in_unit_disk,
+// and an end-to-end render of the final scene at fixed seeds. The results go
+// to stdout as a table and, with --json, to a JSON file that can be kept per
+// commit to track regressions.
+//
+// With --reference, the end-to-end render is also compared against a
+// converged reference image and the program fails when the RMSE exceeds
+// --max-rmse. --write-reference renders that reference (many more samples,
+// same view) instead.
+//
+//   cmake --build build --target benchmark
+//   ./kernel_bench --json out.json --reference ../bench/reference.pfm
+
+#include "rtweekend.h"
+
+#include "arena.h"
+#include "camera.h"
+#include "flat_bvh.h"
+#include "hittable_list.h"
+#include "image_compare.h"
+#include "material.h"
+#include "scenes.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct result {
+  std::string name;
+  std::string unit;
+  double value;
+};
+
+// Keeps results alive so the timed loops cannot be optimized away.
+static volatile double sink;
+
+// Runs batch() (which does `per_batch` operations) until min_seconds have
+// passed and returns nanoseconds per operation.
+template <typename Batch>
+static double ns_per_op(size_t per_batch, Batch batch,
+                        double min_seconds = 0.5) {
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  size_t ops = 0;
+  double elapsed = 0;
+  do {
+    batch();
+    ops += per_batch;
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  } while (elapsed < min_seconds);
+  return elapsed * 1e9 / ops;
+}
+
+// Rays from around the final scene's camera into the scene.
+static std::vector<ray> scene_rays(int count) {
+  std::vector<ray> rays;
+  for (int i = 0; i < count; i++) {
+    auto origin = point3(13, 2, 3) + vec3::random(-0.5, 0.5);
+    auto target = point3(random_double(-10, 10), random_double(-1, 1),
+                         random_double(-6, 6));
+    rays.emplace_back(origin, unit_vector(target - origin));
+  }
+  return rays;
+}
+
+static void kernel_results(std::vector<result> &results) {
+  seed_random(1);
+  arena scene_arena;
+  hittable_list world = book_final_scene(scene_arena);
+  auto rays = scene_rays(4096);
+
+  // One sphere, rays aimed so that about half of them hit it.
+  sphere ball(point3(0, 0, -5), 1.0, make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+  std::vector<ray> ball_rays;
+  for (int i = 0; i < 4096; i++) {
+    auto target = point3(random_double(-1.4, 1.4), random_double(-1.4, 1.4),
+                         -5);
+    ball_rays.emplace_back(point3(0, 0, 0), target);
+  }
+  double sphere_ns = ns_per_op(ball_rays.size(), [&] {
+    hit_record rec;
+    double sum = 0;
+    for (const auto &r : ball_rays)
+      if (ball.hit(r, interval(0.001, infinity), rec))
+        sum += rec.t;
+    sink = sum;
+  });
+  results.push_back({"sphere_hit", "ns/call", sphere_ns});
+
+  double list_ns = ns_per_op(rays.size(), [&] {
+    hit_record rec;
+    double sum = 0;
+    for (const auto &r : rays)
+      if (world.hit(r, interval(0.001, infinity), rec))
+        sum += rec.t;
+    sink = sum;
+  });
+  results.push_back({"hittable_list_hit", "ns/call", list_ns});
+  results.push_back({"hittable_list_hit_per_object", "ns/intersection",
+                     list_ns / world.objects.size()});
+
+  // A typical hit for the scatter kernels: on a sphere, front face.
+  hit_record rec;
+  ray r_in(point3(0, 0, 0), vec3(0.3, -0.2, -1));
+  ball.hit(r_in, interval(0.001, infinity), rec);
+  lambertian diffuse(color(0.5, 0.4, 0.3));
+  metal shiny(color(0.8, 0.8, 0.8), 0.2);
+  dielectric glass(1.5);
+  const material *materials[] = {&diffuse, &shiny, &glass};
+  const char *names[] = {"scatter_lambertian", "scatter_metal",
+                         "scatter_dielectric"};
+  for (int m = 0; m < 3; m++) {
+    const material *mat = materials[m];
+    results.push_back({names[m], "ns/call", ns_per_op(4096, [&] {
+                         double sum = 0;
+                         for (int i = 0; i < 4096; i++) {
+                           color attenuation;
+                           ray scattered;
+                           if (mat->scatter(r_in, rec, attenuation, scattered))
+                             sum += scattered.direction().x();
+                         }
+                         sink = sum;
+                       })});
+  }
+
+  results.push_back({"random_unit_vector", "ns/call", ns_per_op(4096, [] {
+                       double sum = 0;
+                       for (int i = 0; i < 4096; i++)
+                         sum += random_unit_vector().x();
+                       sink = sum;
+                     })});
+  results.push_back({"random_in_unit_disk", "ns/call", ns_per_op(4096, [] {
+                       double sum = 0;
+                       for (int i = 0; i < 4096; i++)
+                         sum += random_in_unit_disk().x();
+                       sink = sum;
+                     })});
+}
+
+// The end-to-end render: the final scene through flat_bvh, fixed seeds.
+static camera::render_summary render_scene(int width, int samples,
+                                           int threads,
+                                           const std::string &path) {
+  seed_random(1);
+  arena scene_arena;
+  hittable_list world = book_final_scene(scene_arena);
+  flat_bvh scene(world);
+
+  camera cam;
+  book_final_view(cam);
+  cam.image_width = width;
+  cam.samples_per_pixel = samples;
+  cam.max_depth = 50;
+  cam.num_threads = threads;
+  cam.sampling = sampler_type::sobol;
+  cam.seed = 1;
+  cam.output_format = image_format::pfm;
+  cam.output_path = path;
+  cam.render(scene);
+  return cam.last_render();
+}
+
+static void write_json(const std::string &path,
+                       const std::vector<result> &results, double rmse,
+                       double max_rmse, bool gated) {
+  std::FILE *out = std::fopen(path.c_str(), "w");
+  if (!out) {
+    std::fprintf(stderr, "cannot write %s\n", path.c_str());
+    return;
+  }
+  std::fprintf(out, "{\n  \"precision\": \"%s\",\n  \"results\": [\n",
+               sizeof(real) == sizeof(float) ? "float" : "double");
+  for (size_t k = 0; k < results.size(); k++)
+    std::fprintf(out, "    {\"name\": \"%s\", \"unit\": \"%s\", "
+                      "\"value\": %.6g}%s\n",
+                 results[k].name.c_str(), results[k].unit.c_str(),
+                 results[k].value, k + 1 < results.size() ? "," : "");
+  std::fprintf(out, "  ]");
+  if (gated)
+    std::fprintf(out,
+                 ",\n  \"correctness\": {\"rmse\": %.6g, \"max_rmse\": %.6g, "
+                 "\"pass\": %s}",
+                 rmse, max_rmse, rmse >= 0 && rmse <= max_rmse ? "true"
+                                                               : "false");
+  std::fprintf(out, "\n}\n");
+  std::fclose(out);
+}
+
+int main(int argc, char **argv) {
+  std::string json_path, reference_path, write_reference_path;
+  std::string image_path = "kernel_bench.pfm";
+  double max_rmse = 0.02;
+  int threads = 0, width = 160, samples = 64;
+  for (int k = 1; k < argc; k++) {
+    std::string arg = argv[k];
+    bool has_value = k + 1 < argc;
+    if (arg == "--json" && has_value)
+      json_path = argv[++k];
+    else if (arg == "--reference" && has_value)
+      reference_path = argv[++k];
+    else if (arg == "--write-reference" && has_value)
+      write_reference_path = argv[++k];
+    else if (arg == "--max-rmse" && has_value)
+      max_rmse = std::atof(argv[++k]);
+    else if (arg == "--threads" && has_value)
+      threads = std::atoi(argv[++k]);
+    else if (arg == "--samples" && has_value)
+      samples = std::atoi(argv[++k]);
+    else if (arg == "--image" && has_value)
+      image_path = argv[++k];
+    else {
+      std::fprintf(stderr,
+                   "usage: %s [--json out.json] [--reference ref.pfm] "
+                   "[--max-rmse x] [--threads n] [--samples n] "
+                   "[--image out.pfm] [--write-reference ref.pfm]\n",
+                   argv[0]);
+      return 2;
+    }
+  }
+
+  if (!write_reference_path.empty()) {
+    render_scene(width, 1024, threads, write_reference_path);
+    return 0;
+  }
+
+  std::vector<result> results;
+  kernel_results(results);
+  auto summary = render_scene(width, samples, threads, image_path);
+  results.push_back({"render_mrays_per_second", "Mrays/s",
+                     summary.rays / summary.seconds * 1e-6});
+  results.push_back({"render_msamples_per_second", "Msamples/s",
+                     summary.samples / summary.seconds * 1e-6});
+
+  for (const auto &r : results)
+    std::printf("%-30s %12.3f %s\n", r.name.c_str(), r.value, r.unit.c_str());
+
+  double rmse = -1;
+  bool gated = !reference_path.empty();
+  if (gated) {
+    framebuffer image, reference;
+    if (!image_compare::load_pfm(image_path, image) ||
+        !image_compare::load_pfm(reference_path, reference)) {
+      std::fprintf(stderr, "cannot read %s or %s\n", image_path.c_str(),
+                   reference_path.c_str());
+      return 2;
+    }
+    rmse = image_compare::rmse(image, reference);
+    std::printf("%-30s %12.6f (max %g) %s\n", "reference_rmse", rmse,
+                max_rmse, rmse >= 0 && rmse <= max_rmse ? "PASS" : "FAIL");
+  }
+
+  if (!json_path.empty())
+    write_json(json_path, results, rmse, max_rmse, gated);
+  return gated && !(rmse >= 0 && rmse <= max_rmse) ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+// Light sampling against the plain path tracer at equal error. A scene under
+// a black sky, lit by two small bright sphere lights, is rendered once at
+// many samples per pixel as the reference. Both integrators then render it
+// at doubling sample counts (with another seed) until their RMSE against
+// the reference drops below the error light sampling reaches at the target
+// count, and the time each needed for that error is reported. An integrator
+// that has not got there by the reference's count is reported with the
+// time it took so far, a lower bound.
+//
+//   g++ -std=c++17 -O2 -pthread -I.. light_bench.cc -o light_bench
+//   ./light_bench [width] [target spp] [reference spp]
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "flat_bvh.h"
+#include "hittable_list.h"
+#include "image_compare.h"
+#include "light_list.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+static hittable_list lit_scene() {
+  seed_random(11);
+  hittable_list world;
+  auto ground = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+  world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground));
+  for (int a = -4; a < 4; a++) {
+    for (int b = -4; b < 4; b++) {
+      point3 center(a + 0.8 * random_double(), 0.2,
+                    b + 0.8 * random_double());
+      auto choose_mat = random_double();
+      shared_ptr<material> mat;
+      if (choose_mat < 0.8)
+        mat = make_shared<lambertian>(color::random() * color::random());
+      else if (choose_mat < 0.95)
+        mat = make_shared<metal>(color::random(0.5, 1), random_double(0, 0.5));
+      else
+        mat = make_shared<dielectric>(1.5);
+      world.add(make_shared<sphere>(center, 0.2, mat));
+    }
+  }
+  world.add(make_shared<sphere>(point3(0, 1, 0), 1.0,
+                                make_shared<dielectric>(1.5)));
+  world.add(make_shared<sphere>(point3(-2.5, 1, -0.5), 1.0,
+                                make_shared<lambertian>(color(0.4, 0.2, 0.1))));
+  auto warm = make_shared<diffuse_light>(color(300, 260, 200));
+  auto cold = make_shared<diffuse_light>(color(80, 120, 400));
+  world.add(make_shared<sphere>(point3(1, 3, 1.5), 0.15, warm));
+  world.add(make_shared<sphere>(point3(-3, 2, 3), 0.1, cold));
+  return world;
+}
+
+struct result {
+  int spp;
+  double seconds;
+  double error;
+};
+
+static result render(const hittable &scene, const light_list &lights,
+                     int width, int spp, bool light_sampling, unsigned seed,
+                     const std::string &path) {
+  camera cam;
+  cam.aspect_ratio = 16.0 / 9.0;
+  cam.image_width = width;
+  cam.samples_per_pixel = spp;
+  cam.max_depth = 8;
+  cam.num_threads = 0;
+  cam.seed = seed;
+  cam.vfov = 30;
+  cam.lookfrom = point3(7, 3, 6);
+  cam.lookat = point3(0, 0.5, 0);
+  cam.sky_brightness = 0;
+  cam.light_sampling = light_sampling;
+  cam.output_format = image_format::pfm;
+  cam.output_path = path;
+  cam.render(scene, lights);
+  return {spp, cam.last_render().seconds, 0};
+}
+
+static double error(const std::string &image, const framebuffer &reference) {
+  framebuffer f;
+  return image_compare::load_pfm(image, f) ? image_compare::rmse(f, reference)
+                                           : -1;
+}
+
+int main(int argc, char **argv) {
+  int width = argc > 1 ? std::atoi(argv[1]) : 240;
+  int target_spp = argc > 2 ? std::atoi(argv[2]) : 16;
+  int reference_spp = argc > 3 ? std::atoi(argv[3]) : 1024;
+
+  auto world = lit_scene();
+  flat_bvh scene(world);
+  light_list lights(world);
+  const std::string reference_path = "light_bench_reference.pfm";
+  const std::string path = "light_bench.pfm";
+
+  render(scene, lights, width, reference_spp, true, 1, reference_path);
+  framebuffer reference;
+  if (!image_compare::load_pfm(reference_path, reference)) {
+    std::fprintf(stderr, "Cannot read %s\n", reference_path.c_str());
+    return 1;
+  }
+
+  result target = render(scene, lights, width, target_spp, true, 2, path);
+  target.error = error(path, reference);
+
+  std::printf("\n%-16s %8s %10s %10s\n", "integrator", "spp", "seconds",
+              "rmse");
+  const char *names[2] = {"paths only", "light sampling"};
+  result at_target[2];
+  for (int light_sampling = 0; light_sampling < 2; light_sampling++) {
+    result r{};
+    for (int spp = 1; spp <= reference_spp; spp *= 2) {
+      r = render(scene, lights, width, spp, light_sampling, 2, path);
+      r.error = error(path, reference);
+      std::printf("%-16s %8d %10.3f %10.5f\n", names[light_sampling], r.spp,
+                  r.seconds, r.error);
+      if (r.error <= target.error)
+        break;
+    }
+    at_target[light_sampling] = r;
+  }
+  std::remove(reference_path.c_str());
+  std::remove(path.c_str());
+
+  bool reached = at_target[0].error <= target.error;
+  std::printf("\nrmse %.5f: paths only %s%d spp in %.3f s, light sampling %d "
+              "spp in %.3f s, %s%.1fx faster\n",
+              target.error, reached ? "" : "more than ", at_target[0].spp,
+              at_target[0].seconds, at_target[1].spp, at_target[1].seconds,
+              reached ? "" : "more than ",
+              at_target[0].seconds / at_target[1].seconds);
+  return 0;
+}
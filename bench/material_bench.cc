@@ -0,0 +1,97 @@
+// Scatter throughput through the virtual material::scatter versus the
+// material_record switch, over the same mix of lambertian, metal and
+// dielectric hits, both in scene order (types interleaved) and sorted by
+// material type as the wavefront integrator evaluates them.
+//
+//   g++ -std=c++17 -O2 -I.. material_bench.cc -o material_bench
+
+#include "rtweekend.h"
+
+#include "material.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+struct bench_hit {
+  ray r_in;
+  hit_record rec;
+};
+
+// Calls scatter on every hit for at least min_seconds; returns ns per call.
+template <typename Scatter>
+static double measure(const std::vector<bench_hit> &hits, Scatter scatter_one,
+                      double min_seconds, double &checksum) {
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  size_t calls = 0;
+  double elapsed = 0;
+  do {
+    seed_random(3); // Same random numbers for every variant and pass.
+    double sum = 0;
+    for (const auto &h : hits) {
+      color attenuation;
+      ray scattered;
+      if (scatter_one(h, attenuation, scattered))
+        sum += attenuation.x() + scattered.direction().y();
+    }
+    checksum = sum;
+    calls += hits.size();
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  } while (elapsed < min_seconds);
+  return elapsed * 1e9 / calls;
+}
+
+int main() {
+  seed_random(1);
+  std::vector<shared_ptr<material>> materials;
+  for (int i = 0; i < 64; i++) {
+    auto choose = random_double();
+    if (choose < 0.6)
+      materials.push_back(
+          make_shared<lambertian>(color::random() * color::random()));
+    else if (choose < 0.85)
+      materials.push_back(
+          make_shared<metal>(color::random(0.5, 1), random_double(0, 0.5)));
+    else
+      materials.push_back(make_shared<dielectric>(1.5));
+  }
+  std::vector<material_record> records;
+  for (const auto &m : materials)
+    records.push_back(material_record::from(m.get()));
+
+  std::vector<bench_hit> hits(100000);
+  for (auto &h : hits) {
+    auto m = size_t(random_double() * materials.size());
+    h.r_in = ray(point3(0, 0, 0), random_unit_vector());
+    h.rec.p = point3(0, 0, 0) + 3 * h.r_in.direction();
+    h.rec.set_face_normal(h.r_in, random_unit_vector());
+    h.rec.t = 3;
+    h.rec.mat = materials[m].get();
+    h.rec.record = &records[m];
+  }
+
+  auto virtual_call = [](const bench_hit &h, color &a, ray &s) {
+    return h.rec.mat->scatter(h.r_in, h.rec, a, s);
+  };
+  auto record_call = [](const bench_hit &h, color &a, ray &s) {
+    return h.rec.record->scatter(h.r_in, h.rec, a, s);
+  };
+
+  std::printf("%-10s %14s %14s %9s\n", "order", "virtual ns", "record ns",
+              "speedup");
+  for (int sorted = 0; sorted < 2; sorted++) {
+    if (sorted)
+      std::stable_sort(hits.begin(), hits.end(),
+                       [](const bench_hit &a, const bench_hit &b) {
+                         return a.rec.record->type() < b.rec.record->type();
+                       });
+    double sum_v, sum_r;
+    double ns_v = measure(hits, virtual_call, 1.0, sum_v);
+    double ns_r = measure(hits, record_call, 1.0, sum_r);
+    std::printf("%-10s %14.2f %14.2f %8.2fx%s\n",
+                sorted ? "by type" : "scene", ns_v, ns_r, ns_v / ns_r,
+                sum_v == sum_r ? "" : "  (RESULT MISMATCH)");
+  }
+}
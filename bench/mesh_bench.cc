@@ -0,0 +1,121 @@
+// Triangle meshes end to end: writes a finely tessellated sphere as an OBJ
+// file (quads with vertex normals, so the loader splits faces and resolves
+// normal indices), loads it with one and with every parser thread, builds
+// the tree over its triangles and fires rays at it. The triangles lie on
+// the sphere, so every ray must hit, close to the analytic distance.
+//
+//   g++ -std=c++17 -O2 -I.. mesh_bench.cc -o mesh_bench
+//   ./mesh_bench [stacks] [slices] [obj path]
+
+#include "rtweekend.h"
+
+#include "flat_bvh.h"
+#include "obj_file.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+using seconds = std::chrono::duration<double>;
+
+// A unit sphere at the origin as stacks x slices quads, with triangles at
+// the poles. Returns the file size in bytes, or 0 if it cannot be written.
+static double write_sphere(const std::string &path, int stacks, int slices) {
+  std::FILE *out = std::fopen(path.c_str(), "w");
+  if (!out)
+    return 0;
+  std::fprintf(out, "# %d x %d sphere\nv 0 1 0\nvn 0 1 0\n", stacks, slices);
+  for (int i = 1; i < stacks; i++) {
+    double theta = pi * i / stacks;
+    for (int j = 0; j < slices; j++) {
+      double phi = 2 * pi * j / slices;
+      double x = std::sin(theta) * std::cos(phi), y = std::cos(theta);
+      double z = std::sin(theta) * std::sin(phi);
+      std::fprintf(out, "v %.9g %.9g %.9g\nvn %.9g %.9g %.9g\n", x, y, z, x,
+                   y, z);
+    }
+  }
+  std::fprintf(out, "v 0 -1 0\nvn 0 -1 0\n");
+
+  // Vertex 1 is the north pole, then the rings, then the south pole.
+  auto ring = [&](int i, int j) { return 2 + (i - 1) * slices + j % slices; };
+  int south = 2 + (stacks - 1) * slices;
+  for (int j = 0; j < slices; j++)
+    std::fprintf(out, "f 1//1 %d//%d %d//%d\n", ring(1, j + 1),
+                 ring(1, j + 1), ring(1, j), ring(1, j));
+  for (int i = 1; i + 1 < stacks; i++) {
+    for (int j = 0; j < slices; j++) {
+      int a = ring(i, j), b = ring(i, j + 1);
+      int c = ring(i + 1, j + 1), d = ring(i + 1, j);
+      std::fprintf(out, "f %d//%d %d//%d %d//%d %d//%d\n", a, a, b, b, c, c,
+                   d, d);
+    }
+  }
+  for (int j = 0; j < slices; j++)
+    std::fprintf(out, "f %d//%d %d//%d %d//%d\n", ring(stacks - 1, j),
+                 ring(stacks - 1, j), ring(stacks - 1, j + 1),
+                 ring(stacks - 1, j + 1), south, south);
+  long size = std::ftell(out);
+  return std::fclose(out) == 0 ? double(size) : 0;
+}
+
+int main(int argc, char **argv) {
+  int stacks = argc > 1 ? std::atoi(argv[1]) : 500;
+  int slices = argc > 2 ? std::atoi(argv[2]) : 1000;
+  std::string path = argc > 3 ? argv[3] : "mesh_bench.obj";
+
+  double bytes = write_sphere(path, stacks, slices);
+  if (bytes == 0) {
+    std::fprintf(stderr, "Cannot write %s\n", path.c_str());
+    return 1;
+  }
+
+  std::unique_ptr<triangle_mesh> mesh;
+  std::printf("%-22s %10s %12s %10s\n", "load", "seconds", "Mtris/s", "MB/s");
+  for (int threads : {1, 0}) {
+    auto loaded = std::make_unique<triangle_mesh>();
+    std::string error;
+    auto start = std::chrono::steady_clock::now();
+    if (!obj_file::load(path, *loaded, error, threads)) {
+      std::fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    double s = seconds(std::chrono::steady_clock::now() - start).count();
+    int used = threads ? threads : thread_pool::default_thread_count();
+    std::printf("%2d thread(s)           %10.3f %12.2f %10.1f\n", used, s,
+                loaded->size() / s * 1e-6, bytes / s / (1 << 20));
+    mesh = std::move(loaded);
+  }
+  std::remove(path.c_str());
+
+  auto start = std::chrono::steady_clock::now();
+  flat_bvh tree(*mesh);
+  double build = seconds(std::chrono::steady_clock::now() - start).count();
+  std::printf("%zu triangles, tree built in %.3f s\n", mesh->size(), build);
+
+  // Rays from a shell around the sphere towards points inside it. A hit on
+  // the tessellation lies slightly inside the sphere, never outside.
+  const int n = 1000000;
+  int hits = 0;
+  double worst = 0;
+  seed_random(3);
+  start = std::chrono::steady_clock::now();
+  for (int k = 0; k < n; k++) {
+    point3 origin = 3 * random_unit_vector();
+    vec3 direction = 0.5 * random_unit_vector() - origin;
+    ray r(origin, direction);
+    hit_record rec;
+    if (!tree.hit(r, interval(0.001, infinity), rec))
+      continue;
+    hits++;
+    worst = std::fmax(worst, std::fabs(1 - rec.p.length()));
+  }
+  double trace = seconds(std::chrono::steady_clock::now() - start).count();
+  std::printf("%d of %d rays hit, %.3f Mrays/s, largest distance from the "
+              "sphere %.2e\n",
+              hits, n, n / trace * 1e-6, worst);
+  return hits == n ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+// Checks that a single precision build renders close enough to the double
+// build. Each build renders the same scene at the same seeds to a PFM, and
+// compare reports the RMSE of the two images and fails above a threshold.
+//
+//   g++ -std=c++17 -O2 -pthread -I.. precision_check.cc -o check_double
+//   g++ -std=c++17 -O2 -pthread -I.. -DRTWEEKEND_FLOAT -DRTWEEKEND_SIMD
+//       precision_check.cc -o check_float
+//   ./check_double render double.pfm && ./check_float render float.pfm
+//   ./check_double compare double.pfm float.pfm 0.01
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "flat_bvh.h"
+#include "hittable_list.h"
+#include "image_compare.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static hittable_list book_scene() {
+  seed_random(7);
+  hittable_list world;
+  auto ground = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+  world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground));
+
+  for (int a = -11; a < 11; a++) {
+    for (int b = -11; b < 11; b++) {
+      auto choose_mat = random_double();
+      point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+      if ((center - point3(4, 0.2, 0)).length() <= 0.9)
+        continue;
+      shared_ptr<material> mat;
+      if (choose_mat < 0.8)
+        mat = make_shared<lambertian>(color::random() * color::random());
+      else if (choose_mat < 0.95)
+        mat = make_shared<metal>(color::random(0.5, 1), random_double(0, 0.5));
+      else
+        mat = make_shared<dielectric>(1.5);
+      world.add(make_shared<sphere>(center, 0.2, mat));
+    }
+  }
+
+  world.add(make_shared<sphere>(point3(0, 1, 0), 1.0,
+                                make_shared<dielectric>(1.5)));
+  world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0,
+                                make_shared<lambertian>(color(0.4, 0.2, 0.1))));
+  world.add(make_shared<sphere>(point3(4, 1, 0), 1.0,
+                                make_shared<metal>(color(0.7, 0.6, 0.5), 0.0)));
+  return world;
+}
+
+static int render(const char *path) {
+  auto world = book_scene();
+  flat_bvh scene(world);
+
+  camera cam;
+  cam.aspect_ratio = 16.0 / 9.0;
+  cam.image_width = 320;
+  cam.samples_per_pixel = 32;
+  cam.max_depth = 50;
+  cam.num_threads = 0;
+  cam.sampling = sampler_type::sobol;
+  cam.vfov = 20;
+  cam.lookfrom = point3(13, 2, 3);
+  cam.lookat = point3(0, 0, 0);
+  cam.vup = vec3(0, 1, 0);
+  cam.defocus_angle = 0.6;
+  cam.focus_dist = 10.0;
+  cam.output_format = image_format::pfm;
+  cam.output_path = path;
+  cam.render(scene);
+  std::printf("rendered %s with %zu-byte reals\n", path, sizeof(real));
+  return 0;
+}
+
+static int compare(const char *a_path, const char *b_path, double threshold) {
+  framebuffer a, b;
+  if (!image_compare::load_pfm(a_path, a) ||
+      !image_compare::load_pfm(b_path, b)) {
+    std::printf("cannot read %s or %s\n", a_path, b_path);
+    return 2;
+  }
+  double error = image_compare::rmse(a, b);
+  bool pass = error >= 0 && error <= threshold;
+  std::printf("rmse %.6f (threshold %.6f): %s\n", error, threshold,
+              pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 3 && std::strcmp(argv[1], "render") == 0)
+    return render(argv[2]);
+  if ((argc == 4 || argc == 5) && std::strcmp(argv[1], "compare") == 0)
+    return compare(argv[2], argv[3], argc == 5 ? std::atof(argv[4]) : 0.01);
+  std::printf("usage: %s render out.pfm\n"
+              "       %s compare a.pfm b.pfm [max_rmse]\n",
+              argv[0], argv[0]);
+  return 2;
+}
@@ -0,0 +1,122 @@
+// Startup cost of a large scene: parsing a text scene file and building the
+// BVH, against opening a scene cache with and without the cached BVH. The
+// scene is a grid of small random spheres, each with its own material, like
+// the book's final scene but much larger. All three must trace the same hits.
+//
+//   g++ -std=c++17 -O2 -pthread -I.. scene_load_bench.cc -o scene_load_bench
+//   ./scene_load_bench [spheres] [directory for the scene files]
+
+#include "rtweekend.h"
+
+#include "arena.h"
+#include "camera.h"
+#include "flat_bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "scene_cache.h"
+#include "scene_file.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using seconds = std::chrono::duration<double>;
+
+static hittable_list random_spheres(arena &scene_arena, int count) {
+  hittable_list world;
+  int side = int(std::ceil(std::sqrt(double(count))));
+  for (int k = 0; k < count; k++) {
+    point3 center((k % side) + 0.9 * random_double(), 0.2,
+                  (k / side) + 0.9 * random_double());
+    shared_ptr<material> mat;
+    auto choose_mat = random_double();
+    if (choose_mat < 0.8)
+      mat = scene_arena.make<lambertian>(color::random() * color::random());
+    else if (choose_mat < 0.95)
+      mat = scene_arena.make<metal>(color::random(0.5, 1),
+                                    random_double(0, 0.5));
+    else
+      mat = scene_arena.make<dielectric>(1.5);
+    world.add(scene_arena.make<sphere>(center, 0.2, mat));
+  }
+  return world;
+}
+
+// Sum of the hit distances of a fixed set of rays, to check that every way
+// of loading the scene gives the same geometry.
+static double trace_checksum(const hittable &world, int side) {
+  seed_random(7);
+  double sum = 0;
+  for (int k = 0; k < 100000; k++) {
+    point3 origin(random_double(0, side), 3, random_double(0, side));
+    vec3 direction(random_double(-1, 1), -1, random_double(-1, 1));
+    hit_record rec;
+    if (world.hit(ray(origin, direction), interval(0.001, infinity), rec))
+      sum += rec.t;
+  }
+  return sum;
+}
+
+int main(int argc, char **argv) {
+  int count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  std::string dir = argc > 2 ? argv[2] : ".";
+  std::string text_path = dir + "/scene_load_bench.txt";
+  std::string cache_path = dir + "/scene_load_bench.cache";
+  std::string nobvh_path = dir + "/scene_load_bench_nobvh.cache";
+  int side = int(std::ceil(std::sqrt(double(count))));
+
+  {
+    seed_random(1);
+    arena scene_arena;
+    hittable_list world = random_spheres(scene_arena, count);
+    camera cam;
+    flat_bvh scene(world);
+    if (!scene_file::save(text_path, world, cam) ||
+        !scene_cache::save(cache_path, scene, cam, true) ||
+        !scene_cache::save(nobvh_path, scene, cam, false)) {
+      std::fprintf(stderr, "cannot write the scene files to %s\n",
+                   dir.c_str());
+      return 1;
+    }
+  }
+
+  std::printf("%d spheres\n%-26s %10s %14s\n", count, "load", "seconds",
+              "checksum");
+  std::string error;
+  {
+    auto start = std::chrono::steady_clock::now();
+    arena scene_arena;
+    hittable_list world;
+    camera cam;
+    if (!scene_file::load(text_path, scene_arena, world, cam, error)) {
+      std::fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    auto parsed = std::chrono::steady_clock::now();
+    flat_bvh scene(world);
+    auto built = std::chrono::steady_clock::now();
+    std::printf("%-26s %10.4f\n", "text: parse",
+                seconds(parsed - start).count());
+    std::printf("%-26s %10.4f %14.6f\n", "text: parse + build",
+                seconds(built - start).count(), trace_checksum(scene, side));
+  }
+  for (const auto &path : {cache_path, nobvh_path}) {
+    auto start = std::chrono::steady_clock::now();
+    scene_cache cache;
+    camera cam;
+    if (!cache.open(path, cam, error)) {
+      std::fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    auto opened = std::chrono::steady_clock::now();
+    std::printf("%-26s %10.4f %14.6f\n",
+                path == cache_path ? "cache with BVH: open"
+                                   : "cache without BVH: open",
+                seconds(opened - start).count(),
+                trace_checksum(cache.world(), side));
+  }
+}
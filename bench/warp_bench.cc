@@ -0,0 +1,133 @@
+// The direct sampling warps of warp.h against the rejection samplers they
+// replaced: nanoseconds per sample, and a convergence check that every
+// sampler, fed either by the random stream or by a stratified grid, gets the
+// moments of its distribution right.
+//
+//   g++ -std=c++17 -O2 -I.. warp_bench.cc -o warp_bench && ./warp_bench
+
+#include "rtweekend.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+// The rejection samplers vec3.h used to have.
+static vec3 rejection_unit_vector() {
+  while (true) {
+    auto p = vec3::random(-1, 1);
+    auto lensq = p.length_squared();
+    if (1e-160 < lensq && lensq <= 1)
+      return p / std::sqrt(lensq);
+  }
+}
+
+static vec3 rejection_in_unit_disk() {
+  while (true) {
+    auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
+    if (p.length_squared() < 1)
+      return p;
+  }
+}
+
+static const vec3 normal = unit_vector(vec3(0.3, 0.9, -0.2));
+
+static volatile double sink;
+
+static double ns_per_sample(const std::function<vec3()> &sample) {
+  using clock = std::chrono::steady_clock;
+  const int n = 4 << 20;
+  seed_random(1);
+  double sum = 0;
+  auto start = clock::now();
+  for (int k = 0; k < n; k++)
+    sum += sample().x();
+  std::chrono::duration<double> elapsed = clock::now() - start;
+  sink = sum;
+  return elapsed.count() * 1e9 / n;
+}
+
+// Sample means of f, which should approach the expected value, with the
+// random stream and with a jittered 512 x 512 grid for (u0, u1).
+struct moment {
+  const char *name;
+  double expected;
+  std::function<vec3()> random_sample;
+  std::function<vec3(real, real)> warp; // Null for rejection samplers.
+  std::function<double(const vec3 &)> f;
+};
+
+static void check(const moment &m) {
+  const int side = 512, n = side * side;
+  seed_random(2);
+  double random_mean = 0;
+  for (int k = 0; k < n; k++)
+    random_mean += m.f(m.random_sample()) / n;
+  std::printf("%-36s %10.6f %12.2e", m.name, m.expected,
+              std::fabs(random_mean - m.expected));
+  if (m.warp) {
+    double grid_mean = 0;
+    for (int j = 0; j < side; j++)
+      for (int i = 0; i < side; i++)
+        grid_mean += m.f(m.warp(real((i + random_double()) / side),
+                                real((j + random_double()) / side))) /
+                     n;
+    std::printf(" %12.2e", std::fabs(grid_mean - m.expected));
+  }
+  std::printf("\n");
+}
+
+int main() {
+  std::printf("%-36s %10s\n", "sampler", "ns/sample");
+  std::printf("%-36s %10.2f\n", "unit vector (rejection)",
+              ns_per_sample(rejection_unit_vector));
+  std::printf("%-36s %10.2f\n", "unit vector (uniform_sphere)",
+              ns_per_sample(random_unit_vector));
+  std::printf("%-36s %10.2f\n", "unit disk (rejection)",
+              ns_per_sample(rejection_in_unit_disk));
+  std::printf("%-36s %10.2f\n", "unit disk (concentric_disk)",
+              ns_per_sample(random_in_unit_disk));
+  std::printf("%-36s %10.2f\n", "cosine (normal + rejection)",
+              ns_per_sample([] {
+                return unit_vector(normal + rejection_unit_vector());
+              }));
+  std::printf("%-36s %10.2f\n", "cosine (cosine_hemisphere)",
+              ns_per_sample([] { return random_cosine_direction(normal); }));
+
+  // Expected values: E[z^2] = 1/3 on the sphere, E[r^2] = 1/2 on the disk,
+  // E[cos] = 2/3 and E[cos^2] = 1/2 for cosine-weighted directions.
+  auto z2 = [](const vec3 &v) { return double(v.z() * v.z()); };
+  auto x = [](const vec3 &v) { return double(v.x()); };
+  auto r2 = [](const vec3 &v) { return double(v.length_squared()); };
+  auto cosine = [](const vec3 &v) { return double(dot(v, normal)); };
+  auto cosine2 = [](const vec3 &v) {
+    auto c = double(dot(v, normal));
+    return c * c;
+  };
+  auto lambert = [] { return unit_vector(normal + rejection_unit_vector()); };
+  auto warp_cosine = [](real u0, real u1) {
+    return cosine_hemisphere(normal, u0, u1);
+  };
+
+  std::printf("\n%-36s %10s %12s %12s\n", "moment", "expected",
+              "|err| random", "|err| grid");
+  std::vector<moment> moments = {
+      {"sphere E[z^2] (rejection)", 1.0 / 3, rejection_unit_vector, nullptr,
+       z2},
+      {"sphere E[z^2] (uniform_sphere)", 1.0 / 3, random_unit_vector,
+       uniform_sphere, z2},
+      {"sphere E[x] (uniform_sphere)", 0, random_unit_vector, uniform_sphere,
+       x},
+      {"disk E[r^2] (rejection)", 0.5, rejection_in_unit_disk, nullptr, r2},
+      {"disk E[r^2] (concentric_disk)", 0.5, random_in_unit_disk,
+       concentric_disk, r2},
+      {"cosine E[cos] (rejection)", 2.0 / 3, lambert, nullptr, cosine},
+      {"cosine E[cos] (cosine_hemisphere)", 2.0 / 3,
+       [] { return random_cosine_direction(normal); }, warp_cosine, cosine},
+      {"cosine E[cos^2] (cosine_hemisphere)", 0.5,
+       [] { return random_cosine_direction(normal); }, warp_cosine, cosine2},
+  };
+  for (const auto &m : moments)
+    check(m);
+}
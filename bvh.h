@@ -0,0 +1,180 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "aabb.h"
+#include "arena.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "trace_stats.h"
+
+#include <algorithm>
+#include <vector>
+
+// Bounding volume hierarchy over a list of hittables. Each node splits its
+// objects in two where the surface area heuristic (SAH) predicts the cheapest
+// traversal, so a ray only visits the objects whose boxes it actually crosses
+// instead of every object in the list.
+class bvh_node : public hittable {
+public:
+  bvh_node(hittable_list list) : bvh_node(list.objects, 0, list.objects.size()) {
+    // There's a C++ subtlety here. This constructor (without span indices)
+    // creates an implicit copy of the hittable list, which we will modify. The
+    // lifetime of the copied list only extends until this constructor exits.
+    // That's OK, because we only need to persist the resulting bounding volume
+    // hierarchy.
+  }
+
+  // Same, with the nodes placed in an arena (see arena.h) instead of one heap
+  // allocation each. The arena must outlive the tree.
+  bvh_node(hittable_list list, arena &nodes)
+      : bvh_node(list.objects, 0, list.objects.size(), &nodes) {}
+
+  bvh_node(std::vector<shared_ptr<hittable>> &objects, size_t start,
+           size_t end, arena *nodes = nullptr) {
+    bbox = aabb::empty;
+    for (size_t i = start; i < end; i++)
+      bbox = aabb(bbox, objects[i]->bounding_box());
+
+    size_t object_span = end - start;
+
+    if (object_span == 0) {
+      return;
+    } else if (object_span == 1) {
+      left = right = objects[start];
+      return;
+    } else if (object_span == 2) {
+      left = objects[start];
+      right = objects[start + 1];
+      return;
+    }
+
+    size_t mid = sah_partition(objects, start, end);
+    if (nodes) {
+      left = nodes->make<bvh_node>(objects, start, mid, nodes);
+      right = nodes->make<bvh_node>(objects, mid, end, nodes);
+    } else {
+      left = make_shared<bvh_node>(objects, start, mid);
+      right = make_shared<bvh_node>(objects, mid, end);
+    }
+  }
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    TRACE_STAT(trace_counters::local().box_tests++);
+    if (!left || !bbox.hit(r, ray_t))
+      return false;
+
+    bool hit_left = left->hit(r, ray_t, rec);
+    if (right == left)
+      return hit_left;
+    bool hit_right =
+        right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+    return hit_left || hit_right;
+  }
+
+  bool occluded(const ray &r, interval ray_t) const override {
+    TRACE_STAT(trace_counters::local().box_tests++);
+    if (!left || !bbox.hit(r, ray_t))
+      return false;
+    return left->occluded(r, ray_t) ||
+           (right != left && right->occluded(r, ray_t));
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  const shared_ptr<hittable> &left_child() const { return left; }
+  const shared_ptr<hittable> &right_child() const { return right; }
+
+private:
+  shared_ptr<hittable> left;
+  shared_ptr<hittable> right;
+  aabb bbox;
+
+  static constexpr int sah_bins = 16;
+
+  struct bin {
+    aabb bounds;
+    size_t count = 0;
+  };
+
+  static int bin_index(double c, const interval &extent) {
+    int b = int(sah_bins * (c - extent.min) / extent.size());
+    return std::clamp(b, 0, sah_bins - 1);
+  }
+
+  // Binned SAH split. Object centroids are dropped into sah_bins buckets along
+  // each axis, and the split between buckets minimising
+  //   area(left) * count(left) + area(right) * count(right)
+  // is chosen. Partitions the span in place and returns the split index.
+  static size_t sah_partition(std::vector<shared_ptr<hittable>> &objects,
+                              size_t start, size_t end) {
+    aabb centroid_bounds;
+    for (size_t i = start; i < end; i++) {
+      auto c = objects[i]->bounding_box().centroid();
+      centroid_bounds = aabb(centroid_bounds, aabb(c, c));
+    }
+
+    int best_axis = -1;
+    int best_split = 0;
+    double best_cost = infinity;
+
+    for (int axis = 0; axis < 3; axis++) {
+      const interval &extent = centroid_bounds.axis_interval(axis);
+      if (extent.size() <= 0)
+        continue;
+
+      bin bins[sah_bins];
+      for (size_t i = start; i < end; i++) {
+        auto box = objects[i]->bounding_box();
+        auto &b = bins[bin_index(box.centroid()[axis], extent)];
+        b.bounds = aabb(b.bounds, box);
+        b.count++;
+      }
+
+      // Sweep from the right to get the cost of every right-hand side, then
+      // from the left to combine it with every left-hand side.
+      double right_area[sah_bins];
+      size_t right_count[sah_bins];
+      aabb acc;
+      size_t count = 0;
+      for (int b = sah_bins - 1; b > 0; b--) {
+        acc = aabb(acc, bins[b].bounds);
+        count += bins[b].count;
+        right_area[b] = acc.surface_area();
+        right_count[b] = count;
+      }
+
+      acc = aabb();
+      count = 0;
+      for (int b = 0; b < sah_bins - 1; b++) {
+        acc = aabb(acc, bins[b].bounds);
+        count += bins[b].count;
+        if (count == 0 || right_count[b + 1] == 0)
+          continue;
+        double cost = acc.surface_area() * count +
+                      right_area[b + 1] * right_count[b + 1];
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_split = b;
+        }
+      }
+    }
+
+    if (best_axis < 0) {
+      // All centroids coincide, so no plane separates them. Split by count.
+      return start + (end - start) / 2;
+    }
+
+    const interval &extent = centroid_bounds.axis_interval(best_axis);
+    auto mid_it = std::partition(
+        objects.begin() + start, objects.begin() + end,
+        [&](const shared_ptr<hittable> &object) {
+          auto c = object->bounding_box().centroid()[best_axis];
+          return bin_index(c, extent) <= best_split;
+        });
+    return size_t(mid_it - objects.begin());
+  }
+};
+
+#endif // !BVH_H
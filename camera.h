@@ -1,11 +1,32 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "alloc_counter.h"
+#include "checkpoint.h"
+#include "framebuffer.h"
 #include "hittable.h"
+#include "image_writer.h"
+#include "light_list.h"
 #include "material.h"
+#include "process_pool.h"
 #include "rtweekend.h"
+#include "sampler.h"
+#include "thread_pool.h"
+#include "trace_stats.h"
 #include "vec3.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <typeindex>
+#include <vector>
+
 class camera {
 public:
   // Simple default values.
@@ -28,29 +49,186 @@ public:
   double focus_dist =
       10; // Distance from camera lookfrom point to plane of perfect focus.
 
+  // Parallel rendering. The image is split into tile_size x tile_size tiles
+  // which are handed to a work-stealing pool of num_threads workers (0 picks
+  // the hardware thread count). Every pixel sample draws its random numbers
+  // from (seed, pixel, sample index) alone, so the image does not depend on
+  // the thread count, the tile size or which thread ran which tile. The
+  // pool is started by the first render() that needs it and kept for the
+  // next ones, so a camera rendering many frames starts its threads once.
+  // Copies of a camera do not share it: each starts its own.
+  int num_threads = 1;
+  int tile_size = 32;
+  unsigned int seed = 0;
+
+  // Sample generator for the pixel, lens and bounce dimensions (see
+  // sampler.h).
+  sampler_type sampling = sampler_type::independent;
+
+  // Packet tracing of primary rays: tiles are traced in 8x8 pixel blocks, one
+  // ray_packet per sample index, through hittable::hit_packet. Bounces are
+  // traced as single rays since they no longer travel together. The image is
+  // identical to the single-ray path.
+  bool packet_primary = false;
+
+  // Wavefront (breadth-first) path tracing. Instead of following one path to
+  // the end, a tile keeps a queue of wavefront_size paths and advances all of
+  // them one bounce at a time: intersect the whole queue, bin the hits by
+  // material type, run each material's scatter over its bin, test the
+  // bounce's shadow rays in one batch, then compact away finished paths.
+  // Same image in expectation as the recursive path.
+  bool wavefront = false;
+  int wavefront_size = 16384;
+
+  // Russian roulette. After roulette_min_depth bounces a path continues with
+  // probability p (its largest throughput component, at most 0.95) and is
+  // reweighted by 1/p, so the expected value is unchanged while paths that
+  // can barely contribute anything stop early.
+  bool russian_roulette = false;
+  int roulette_min_depth = 3;
+
+  // Explicit light sampling (next event estimation), for renders given a
+  // light_list. At every hit on a material that can be lit this way (see
+  // material::scattering_pdf) a direction towards one of the lights is
+  // sampled as well as the material's own, and a shadow ray checks that
+  // nothing is in the way. Both estimates of the light are kept, weighted by
+  // multiple importance sampling (Veach's power heuristic), so small bright
+  // lights, which scattered rays rarely find, converge in far fewer samples,
+  // and large ones are no noisier than before. Without it light is only
+  // found by hitting it.
+  bool light_sampling = true;
+
+  // Scales the sky gradient behind the scene; 0 leaves it lit by its lights
+  // alone.
+  double sky_brightness = 1;
+
+  // Print a histogram of path terminations per bounce after rendering.
+  bool print_path_histogram = false;
+
+  // Adaptive sampling. Pixels are sampled in batches of adaptive_batch while
+  // a running mean and variance of the sample luminance are kept (Welford's
+  // algorithm). A pixel stops once the 95% confidence interval half-width
+  // drops below adaptive_threshold times its mean luminance, or once it
+  // reaches samples_per_pixel, which becomes the hard maximum. Adaptive
+  // sampling uses the single-ray integrator. If sample_heatmap_path is set,
+  // a heatmap of the per-pixel sample counts is written there as a PPM.
+  bool adaptive_sampling = false;
+  int adaptive_batch = 16;
+  double adaptive_threshold = 0.02;
+  std::string sample_heatmap_path;
+
+  // Output image. With an empty output_path the image goes to stdout.
+  image_format output_format = image_format::ppm;
+  std::string output_path;
+
+  // Progressive rendering. With pass_samples > 0 the image is rendered in
+  // passes of that many samples per pixel, and after every pass the current
+  // average is written to preview_path (if set) in output_format. Passes add
+  // to running per-pixel sums, so the final image is identical to a single
+  // pass.
+  //
+  // With checkpoint_path set, the sums are saved there every
+  // checkpoint_interval passes and after the last one (see checkpoint.h). A
+  // render started with a matching checkpoint on disk resumes after its last
+  // pass instead of starting over. Not used with adaptive sampling.
+  int pass_samples = 0;
+  std::string preview_path;
+  std::string checkpoint_path;
+  int checkpoint_interval = 1;
+
+  // Distributed rendering. With num_workers > 0 the tiles of every pass are
+  // rendered by that many worker processes forked from this one at the start
+  // of render() (see process_pool.h). A job is one tile, a sample range and
+  // the tile's running sums, and the reply is the updated sums, so the image
+  // is identical to an in-process render. Jobs of workers that die are sent
+  // again; tiles that cannot be finished that way are rendered here. Each
+  // worker renders single-threaded, and the path histogram only covers tiles
+  // rendered in this process. Not used with adaptive sampling.
+  int num_workers = 0;
+
+  // Render statistics, only collected in builds with -DRTWEEKEND_STATS (see
+  // trace_stats.h). After rendering, rays by bounce, intersection tests per
+  // ray, scatters per material type, the average path length, time per tile
+  // and per-thread utilization are printed. With stats_json_path set they
+  // are also written there as JSON, and with tile_heatmap_path set a heatmap
+  // of the time spent in each tile is written there as a PPM. Tiles rendered
+  // by worker processes are not included.
+  std::string stats_json_path;
+  std::string tile_heatmap_path;
+
   void render(const hittable &world) {
     initialize();
 
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-    for (int j = 0; j < image_height; j++) {
-      std::clog << "\rScanlines remaining: " << (image_height - j) << ' '
-                << std::flush;
-      for (int i = 0; i < image_width; i++) {
-        color pixel_color(0, 0, 0);
-        // anti-aliasing sampling here.
-        for (int sample = 0; sample < samples_per_pixel; sample++) {
-          ray r = get_ray(i, j);
-          pixel_color += ray_color(r, max_depth, world);
-        }
-        write_color(std::cout, pixel_color * pixel_samples_scale);
-      }
+    framebuffer image(image_width, image_height);
+    render_stats stats;
+    auto start = std::chrono::steady_clock::now();
+    auto allocations_before = allocation_counts::now();
+    if (adaptive_sampling) {
+      stats.sample_counts.assign(size_t(image_width) * image_height, 0);
+      render_tiles(world, image, 0, samples_per_pixel, stats);
+    } else {
+      render_passes(world, image, stats);
     }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    auto allocations = allocation_counts::now() - allocations_before;
+    bool written = output_path.empty()
+                       ? image_writer::write(image, output_format, std::cout)
+                       : image_writer::write(image, output_format, output_path);
 
     std::clog << "\rDone.                         \n";
+    if (!written)
+      std::clog << "Failed to write the image to "
+                << (output_path.empty() ? "stdout" : output_path) << '\n';
+    summary = {elapsed.count(), stats.samples, stats.paths.rays()};
+    report(stats, elapsed.count());
+#ifdef RTWEEKEND_STATS
+    report_trace(stats, elapsed.count());
+#endif
+#ifdef RTWEEKEND_COUNT_ALLOCATIONS
+    std::clog << "Allocations while rendering: " << allocations.heap
+              << " heap, " << allocations.arena << " arena ("
+              << allocations.arena_blocks << " arena blocks)\n";
+#else
+    (void)allocations;
+#endif
+    if (adaptive_sampling && !sample_heatmap_path.empty())
+      write_sample_heatmap(stats.sample_counts);
   }
 
+  // Renders with lights to sample (see light_sampling). They must not
+  // change during the render.
+  void render(const hittable &world, const light_list &lights) {
+    scene_lights = &lights;
+    render(world);
+    scene_lights = nullptr;
+  }
+
+  // Totals of the last render(), for benchmarks. Rays are counted from the
+  // path histogram, so tiles rendered by worker processes are not included.
+  struct render_summary {
+    double seconds = 0;
+    uint64_t samples = 0;
+    uint64_t rays = 0; // Closest-hit queries, i.e. path segments traced.
+  };
+
+  const render_summary &last_render() const { return summary; }
+
 private:
+  render_summary summary;
+  // Owns the thread pool, which copies of the camera leave behind.
+  struct pool_slot {
+    std::unique_ptr<thread_pool> own_pool;
+
+    pool_slot() = default;
+    pool_slot(const pool_slot &) {}
+    pool_slot(pool_slot &&) = default;
+    pool_slot &operator=(const pool_slot &) { return *this; }
+    pool_slot &operator=(pool_slot &&) = default;
+  };
+
+  mutable pool_slot pool; // See num_threads.
+  const light_list *scene_lights = nullptr;  // During render(world, lights).
   int image_height; // Rendered image height in pixels
   double pixel_samples_scale;
   point3 camera_center;
@@ -61,6 +239,856 @@ private:
   vec3 defocus_disk_u; // Defocus disk horizontal radius
   vec3 defocus_disk_v; // Defocus disk vertical radius
 
+  static constexpr int packet_width = 8;
+
+  struct tile {
+    int x0, y0, x1, y1; // Pixel bounds, [x0, x1) x [y0, y1).
+  };
+
+  // Why a path ended.
+  enum path_end { escaped, absorbed, roulette, depth_limit, path_end_count };
+
+  // Path terminations indexed by [path_end][number of bounces]. Each tile
+  // fills its own and merges it once at the end.
+  struct path_histogram {
+    std::vector<uint64_t> counts[path_end_count];
+
+    void record(path_end end, int bounces) {
+      auto &c = counts[end];
+      if (c.size() <= size_t(bounces))
+        c.resize(bounces + 1);
+      c[bounces]++;
+    }
+
+    // A path that escaped or was absorbed after b bounces traced b + 1
+    // rays; one cut by roulette or the depth limit at b traced b.
+    uint64_t rays() const {
+      uint64_t n = 0;
+      for (int end = 0; end < path_end_count; end++) {
+        bool extra = end == escaped || end == absorbed;
+        for (size_t b = 0; b < counts[end].size(); b++)
+          n += counts[end][b] * (b + extra);
+      }
+      return n;
+    }
+
+    // Rays traced at each bounce: a path contributes one to every bounce it
+    // traced a ray at, see rays().
+    std::vector<uint64_t> rays_by_bounce() const {
+      std::vector<uint64_t> rays;
+      for (int end = 0; end < path_end_count; end++) {
+        bool extra = end == escaped || end == absorbed;
+        for (size_t b = 0; b < counts[end].size(); b++) {
+          size_t traced = b + extra;
+          if (rays.size() < traced)
+            rays.resize(traced);
+          for (size_t k = 0; k < traced; k++)
+            rays[k] += counts[end][b];
+        }
+      }
+      return rays;
+    }
+
+    double average_bounces() const {
+      uint64_t total = 0, bounces = 0;
+      for (const auto &c : counts) {
+        for (size_t b = 0; b < c.size(); b++) {
+          total += c[b];
+          bounces += c[b] * b;
+        }
+      }
+      return total > 0 ? double(bounces) / total : 0;
+    }
+
+    void clear() {
+      for (auto &c : counts)
+        std::fill(c.begin(), c.end(), 0);
+    }
+
+    void merge(const path_histogram &other) {
+      for (int end = 0; end < path_end_count; end++) {
+        auto &dst = counts[end];
+        const auto &src = other.counts[end];
+        if (dst.size() < src.size())
+          dst.resize(src.size());
+        for (size_t b = 0; b < src.size(); b++)
+          dst[b] += src[b];
+      }
+    }
+  };
+
+  // One per thread, cleared for every tile, so tiles reuse its storage.
+  static path_histogram &tile_histogram() {
+    thread_local path_histogram hist;
+    hist.clear();
+    return hist;
+  }
+
+  // Shared between worker threads, so only touched once per tile.
+  struct render_stats {
+    std::atomic<uint64_t> primary_rays{0};
+    std::atomic<uint64_t> primary_nanoseconds{0}; // Summed over threads.
+    std::atomic<uint64_t> samples{0};
+    std::mutex mutex;
+    path_histogram paths;
+    std::vector<int> sample_counts; // Per pixel, adaptive sampling only.
+    trace_totals trace;             // Only filled with RTWEEKEND_STATS.
+
+    void merge(const path_histogram &tile_paths) {
+      std::lock_guard<std::mutex> lock(mutex);
+      paths.merge(tile_paths);
+    }
+
+    void merge_trace(size_t tile, double seconds,
+                     const trace_counters &tile_counters) {
+      std::lock_guard<std::mutex> lock(mutex);
+      trace.add_tile(tile, thread_pool::worker_index(), seconds,
+                     tile_counters);
+    }
+  };
+
+  void report(const render_stats &stats, double seconds) const {
+    auto budget = double(image_width) * image_height * samples_per_pixel;
+    auto samples = double(stats.samples);
+    std::clog << "Paths: " << samples / seconds * 1e-6 << " Msamples/s, "
+              << stats.paths.rays() / seconds * 1e-6 << " Mrays/s\n";
+    if (adaptive_sampling)
+      std::clog << "Adaptive sampling: "
+                << samples / (double(image_width) * image_height)
+                << " samples/pixel on average, " << 100 * samples / budget
+                << "% of the fixed budget\n";
+    if (packet_primary && stats.primary_nanoseconds > 0) {
+      // Per thread time, so this is the single-core packet throughput.
+      auto primary_seconds = stats.primary_nanoseconds * 1e-9;
+      std::clog << "Primary rays (packets, first hit only): "
+                << stats.primary_rays / primary_seconds * 1e-6
+                << " Mrays/s per thread\n";
+    }
+    if (print_path_histogram)
+      report_paths(stats.paths);
+  }
+
+  void report_paths(const path_histogram &paths) const {
+    static const char *names[path_end_count] = {"escaped", "absorbed",
+                                                "roulette", "depth limit"};
+    size_t rows = 0;
+    for (const auto &c : paths.counts)
+      rows = std::max(rows, c.size());
+
+    uint64_t total = 0, bounces = 0;
+    std::clog << "Path terminations by bounce:\n  bounce";
+    for (auto name : names)
+      std::clog << "  " << std::setw(12) << name;
+    std::clog << '\n';
+    for (size_t b = 0; b < rows; b++) {
+      std::clog << "  " << std::setw(6) << b;
+      for (const auto &c : paths.counts) {
+        uint64_t n = b < c.size() ? c[b] : 0;
+        total += n;
+        bounces += n * b;
+        std::clog << "  " << std::setw(12) << n;
+      }
+      std::clog << '\n';
+    }
+    if (total > 0)
+      std::clog << "Average path length: " << double(bounces) / total
+                << " bounces\n";
+  }
+
+  static constexpr const char *material_names[trace_counters::material_kinds] =
+      {"lambertian", "metal", "dielectric", "light", "other"};
+
+  void report_trace(const render_stats &stats, double seconds) const {
+    const trace_totals &trace = stats.trace;
+    auto rays = double(std::max<uint64_t>(stats.paths.rays(), 1));
+    auto by_bounce = stats.paths.rays_by_bounce();
+
+    std::clog << "Render statistics:\n  rays by bounce:";
+    for (auto n : by_bounce)
+      std::clog << ' ' << n;
+    std::clog << "\n  primitive tests per ray: "
+              << trace.counters.primitive_tests / rays
+              << "\n  box tests per ray: " << trace.counters.box_tests / rays
+              << "\n  scatters by material:";
+    for (int k = 0; k < trace_counters::material_kinds; k++)
+      std::clog << ' ' << material_names[k] << ' '
+                << trace.counters.material_hits[k];
+    std::clog << "\n  average path length: "
+              << stats.paths.average_bounces() << " bounces\n";
+
+    if (!trace.tile_seconds.empty()) {
+      auto minmax = std::minmax_element(trace.tile_seconds.begin(),
+                                        trace.tile_seconds.end());
+      double total = 0;
+      for (auto t : trace.tile_seconds)
+        total += t;
+      std::clog << "  time per tile: " << *minmax.first * 1e3 << " ms min, "
+                << total / trace.tile_seconds.size() * 1e3 << " ms mean, "
+                << *minmax.second * 1e3 << " ms max (tile "
+                << minmax.second - trace.tile_seconds.begin() << ")\n";
+    }
+    std::clog << "  thread utilization:";
+    for (auto busy : trace.thread_seconds)
+      std::clog << ' ' << std::fixed << std::setprecision(1)
+                << 100 * busy / std::max(trace.tiles_seconds, 1e-9) << '%'
+                << std::defaultfloat << std::setprecision(6);
+    std::clog << '\n';
+
+    if (!stats_json_path.empty() && !write_trace_json(stats, seconds))
+      std::clog << "Failed to write statistics to " << stats_json_path
+                << '\n';
+    if (!tile_heatmap_path.empty())
+      write_tile_heatmap(trace.tile_seconds);
+  }
+
+  bool write_trace_json(const render_stats &stats, double seconds) const {
+    std::ofstream out(stats_json_path);
+    if (!out)
+      return false;
+    const trace_totals &trace = stats.trace;
+    auto rays = std::max<uint64_t>(stats.paths.rays(), 1);
+    auto list = [&out](const auto &values) {
+      out << '[';
+      for (size_t k = 0; k < values.size(); k++)
+        out << (k ? ", " : "") << values[k];
+      out << ']';
+    };
+
+    out << "{\n  \"seconds\": " << seconds
+        << ",\n  \"samples\": " << stats.samples
+        << ",\n  \"rays\": " << stats.paths.rays()
+        << ",\n  \"rays_by_bounce\": ";
+    list(stats.paths.rays_by_bounce());
+    out << ",\n  \"primitive_tests_per_ray\": "
+        << double(trace.counters.primitive_tests) / rays
+        << ",\n  \"box_tests_per_ray\": "
+        << double(trace.counters.box_tests) / rays
+        << ",\n  \"scatters_by_material\": {";
+    for (int k = 0; k < trace_counters::material_kinds; k++)
+      out << (k ? ", " : "") << '"' << material_names[k]
+          << "\": " << trace.counters.material_hits[k];
+    out << "},\n  \"average_path_length\": "
+        << stats.paths.average_bounces()
+        << ",\n  \"tile_size\": " << tile_size
+        << ",\n  \"tile_seconds\": ";
+    list(trace.tile_seconds);
+    std::vector<double> utilization;
+    for (auto busy : trace.thread_seconds)
+      utilization.push_back(busy / std::max(trace.tiles_seconds, 1e-9));
+    out << ",\n  \"thread_utilization\": ";
+    list(utilization);
+    out << "\n}\n";
+    return bool(out);
+  }
+
+  std::vector<tile> make_tiles() const {
+    std::vector<tile> tiles;
+    int size = tile_size > 0 ? tile_size : 1;
+    for (int y = 0; y < image_height; y += size)
+      for (int x = 0; x < image_width; x += size)
+        tiles.push_back({x, y, std::min(x + size, image_width),
+                         std::min(y + size, image_height)});
+    return tiles;
+  }
+
+  // The tile renderers below add samples [begin_sample, end_sample) of every
+  // pixel in the tile to the running sums in accum, one sample at a time, so
+  // the sums come out the same however the sample range is split into passes.
+
+  void render_tile(const hittable &world, const tile &t, framebuffer &accum,
+                   int begin_sample, int end_sample,
+                   render_stats &stats) const {
+    arena::scope frame(arena::frame());
+    auto smp = make_sampler(sampling, seed, arena::frame());
+    path_histogram &hist = tile_histogram();
+    for (int j = t.y0; j < t.y1; j++) {
+      for (int i = t.x0; i < t.x1; i++) {
+        color pixel_color = accum.at(i, j);
+        // anti-aliasing sampling here.
+        for (int sample = begin_sample; sample < end_sample; sample++) {
+          smp->start_pixel_sample(uint64_t(j) * image_width + i, sample);
+          ray r = get_ray(i, j, *smp);
+          pixel_color += ray_color(r, max_depth, world, hist);
+        }
+        accum.at(i, j) = pixel_color;
+      }
+    }
+    stats.merge(hist);
+  }
+
+  // Adaptive sampling writes the finished average of every pixel instead of
+  // a sum, since each pixel has its own sample count.
+  void render_tile_adaptive(const hittable &world, const tile &t,
+                            framebuffer &image, render_stats &stats) const {
+    arena::scope frame(arena::frame());
+    auto smp = make_sampler(sampling, seed, arena::frame());
+    path_histogram &hist = tile_histogram();
+    uint64_t tile_samples = 0;
+    for (int j = t.y0; j < t.y1; j++) {
+      for (int i = t.x0; i < t.x1; i++) {
+        color pixel_color(0, 0, 0);
+        int n = 0;
+        double mean = 0, m2 = 0; // Welford running luminance statistics.
+
+        // anti-aliasing sampling here.
+        while (n < samples_per_pixel) {
+          int batch_end =
+              std::min(n + std::max(adaptive_batch, 2), samples_per_pixel);
+          for (; n < batch_end; n++) {
+            smp->start_pixel_sample(uint64_t(j) * image_width + i, n);
+            ray r = get_ray(i, j, *smp);
+            color sample_color = ray_color(r, max_depth, world, hist);
+            pixel_color += sample_color;
+
+            auto y = luminance(sample_color);
+            auto delta = y - mean;
+            mean += delta / (n + 1);
+            m2 += delta * (y - mean);
+          }
+          if (converged(n, mean, m2))
+            break;
+        }
+
+        image.at(i, j) = pixel_color * (1.0 / n);
+        stats.sample_counts[size_t(j) * image_width + i] = n;
+        tile_samples += n;
+      }
+    }
+    stats.samples += tile_samples;
+    stats.merge(hist);
+  }
+
+  void render_tile_packets(const hittable &world, const tile &t,
+                           framebuffer &accum, int begin_sample,
+                           int end_sample, render_stats &stats) const {
+    using clock = std::chrono::steady_clock;
+    arena::scope frame(arena::frame());
+    auto smp = make_sampler(sampling, seed, arena::frame());
+    path_histogram &hist = tile_histogram();
+    ray_packet packet;
+    // Sampler state of each pixel sample, saved after its primary ray was
+    // generated so the bounces draw exactly what the single-ray path would.
+    sampler::state states[ray_packet::max_size];
+    color sums[ray_packet::max_size];
+    uint64_t rays = 0;
+    clock::duration primary_time{};
+
+    for (int y0 = t.y0; y0 < t.y1; y0 += packet_width) {
+      for (int x0 = t.x0; x0 < t.x1; x0 += packet_width) {
+        int x1 = std::min(x0 + packet_width, t.x1);
+        int y1 = std::min(y0 + packet_width, t.y1);
+        int k = 0;
+        for (int j = y0; j < y1; j++)
+          for (int i = x0; i < x1; i++)
+            sums[k++] = accum.at(i, j);
+
+        for (int sample = begin_sample; sample < end_sample; sample++) {
+          packet.count = 0;
+          for (int j = y0; j < y1; j++) {
+            for (int i = x0; i < x1; i++) {
+              int k = packet.count++;
+              smp->start_pixel_sample(uint64_t(j) * image_width + i, sample);
+              packet.rays[k] = get_ray(i, j, *smp);
+              packet.ray_t[k] = interval(0.001, infinity);
+              states[k] = smp->save();
+            }
+          }
+
+          auto start = clock::now();
+          world.hit_packet(packet);
+          primary_time += clock::now() - start;
+          rays += packet.count;
+
+          for (int k = 0; k < packet.count; k++) {
+            smp->restore(states[k]);
+            if (packet.hit[k] || max_depth <= 0) {
+              sums[k] += ray_color(packet.rays[k], max_depth, world, hist,
+                                   &packet.rec[k]);
+            } else {
+              hist.record(escaped, 0);
+              sums[k] += background(packet.rays[k]);
+            }
+          }
+        }
+
+        k = 0;
+        for (int j = y0; j < y1; j++)
+          for (int i = x0; i < x1; i++)
+            accum.at(i, j) = sums[k++];
+      }
+    }
+
+    stats.merge(hist);
+    stats.primary_rays += rays;
+    stats.primary_nanoseconds +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(primary_time)
+            .count();
+  }
+
+  struct path_state {
+    ray r;
+    color throughput;      // Product of the attenuations along the path so far.
+    sampler::state sample; // Where the path is in its sample's dimensions.
+    uint32_t pixel;        // Index into the tile's pixel sums.
+    int depth;             // Bounces left.
+    double bsdf_pdf;       // Of the last bounce, see emission_weight().
+  };
+
+  void render_tile_wavefront(const hittable &world, const tile &t,
+                             framebuffer &accum, int begin_sample,
+                             int end_sample, render_stats &stats) const {
+    arena::scope frame(arena::frame());
+    auto smp = make_sampler(sampling, seed, arena::frame());
+    path_histogram &hist = tile_histogram();
+    int tile_w = t.x1 - t.x0;
+    int tile_pixels = tile_w * (t.y1 - t.y0);
+    int samples_per_wave = std::max(1, wavefront_size / tile_pixels);
+
+    // All buffers live in the thread's frame arena and are rewound with it.
+    auto &buffers = arena::frame();
+    arena_vector<color> sums(buffers);
+    sums.reserve(tile_pixels);
+    for (int j = t.y0; j < t.y1; j++)
+      for (int i = t.x0; i < t.x1; i++)
+        sums.push_back(accum.at(i, j));
+    size_t max_paths = size_t(tile_pixels) * samples_per_wave;
+    arena_vector<path_state> paths(buffers);
+    arena_vector<hit_record> recs(buffers);
+    arena_vector<bool> hits(buffers);
+    paths.reserve(max_paths);
+    recs.reserve(max_paths);
+    hits.reserve(max_paths);
+    // Shadow rays of one bounce, tested together after shading.
+    arena_vector<ray> shadow_rays(buffers);
+    arena_vector<interval> shadow_t(buffers);
+    arena_vector<color> shadow_light(buffers);
+    arena_vector<uint32_t> shadow_pixel(buffers);
+    bool *blocked = nullptr;
+    if (sample_lights()) {
+      shadow_rays.reserve(max_paths);
+      shadow_t.reserve(max_paths);
+      shadow_light.reserve(max_paths);
+      shadow_pixel.reserve(max_paths);
+      blocked = static_cast<bool *>(
+          buffers.allocate(max_paths * sizeof(bool), alignof(bool)));
+    }
+    // Material bins, one per dynamic material type seen in this tile. Each
+    // bounce counts the hits per bin, then sorts the path indices by bin into
+    // one array (a counting sort), so the buffers are sized once per tile
+    // however unevenly the materials are spread.
+    arena_vector<std::type_index> bin_types(buffers);
+    arena_vector<uint32_t> bin_start(buffers); // Where each bin starts.
+    arena_vector<uint32_t> bin_next(buffers);  // Next free slot per bin.
+    arena_vector<uint32_t> bin_of(buffers);    // Per path.
+    arena_vector<uint32_t> order(buffers);     // Path indices by bin.
+    bin_of.reserve(max_paths);
+    order.reserve(max_paths);
+
+    for (int s0 = begin_sample; s0 < end_sample; s0 += samples_per_wave) {
+      int s1 = std::min(s0 + samples_per_wave, end_sample);
+
+      // Generate camera rays for every pixel and sample of this wave.
+      paths.clear();
+      for (int j = t.y0; j < t.y1; j++) {
+        for (int i = t.x0; i < t.x1; i++) {
+          for (int sample = s0; sample < s1; sample++) {
+            smp->start_pixel_sample(uint64_t(j) * image_width + i, sample);
+            ray r = get_ray(i, j, *smp);
+            auto pixel = uint32_t((j - t.y0) * tile_w + (i - t.x0));
+            paths.push_back({r, color(1, 1, 1), smp->save(), pixel,
+                             max_depth, 0});
+          }
+        }
+      }
+
+      while (!paths.empty()) {
+        // Intersection stage.
+        size_t n = paths.size();
+        recs.resize(n);
+        hits.assign(n, false);
+        bin_of.resize(n);
+
+        for (size_t k = 0; k < n; k++) {
+          auto &path = paths[k];
+          if (path.depth <= 0) {
+            // Only reachable with max_depth <= 0: contributes black.
+            hist.record(depth_limit, 0);
+            continue;
+          }
+          if (!world.hit(path.r, interval(0.001, infinity), recs[k])) {
+            hist.record(escaped, max_depth - path.depth);
+            sums[path.pixel] += path.throughput * background(path.r);
+            path.depth = 0;
+            continue;
+          }
+          hits[k] = true;
+          color emission = emitted(recs[k]);
+          if (!is_black(emission))
+            sums[path.pixel] += path.throughput * emission *
+                                emission_weight(path.bsdf_pdf, path.r, recs[k]);
+
+          std::type_index type(recs[k].record
+                                   ? recs[k].record->material_type()
+                                   : typeid(*recs[k].mat));
+          auto bin = std::find(bin_types.begin(), bin_types.end(), type);
+          if (bin == bin_types.end()) {
+            bin_types.push_back(type);
+            bin = bin_types.end() - 1;
+          }
+          bin_of[k] = uint32_t(bin - bin_types.begin());
+        }
+
+        // Sort the hits by bin: count, prefix sum, scatter.
+        size_t bin_count = bin_types.size();
+        bin_start.assign(bin_count + 1, 0);
+        for (size_t k = 0; k < n; k++)
+          if (hits[k])
+            bin_start[bin_of[k] + 1]++;
+        for (size_t b = 0; b < bin_count; b++)
+          bin_start[b + 1] += bin_start[b];
+        bin_next.assign(bin_start.begin(), bin_start.end() - 1);
+        order.resize(bin_start[bin_count]);
+        for (size_t k = 0; k < n; k++)
+          if (hits[k])
+            order[bin_next[bin_of[k]]++] = uint32_t(k);
+
+        // Shading stage, one material type at a time.
+        shadow_rays.clear();
+        shadow_t.clear();
+        shadow_light.clear();
+        shadow_pixel.clear();
+        for (size_t b = 0; b < bin_count; b++) {
+          for (uint32_t i = bin_start[b]; i < bin_start[b + 1]; i++) {
+            uint32_t k = order[i];
+            auto &path = paths[k];
+            ray scattered;
+            color attenuation;
+            int bounces = max_depth - path.depth;
+            smp->restore(path.sample);
+            if (!scatter(path.r, recs[k], attenuation, scattered)) {
+              hist.record(absorbed, bounces);
+              path.depth = 0;
+            } else {
+              path.depth--;
+              path.bsdf_pdf = 0;
+              shadow_ray shadow;
+              if (path.depth > 0 && sample_lights()) {
+                if (sample_light(recs[k], attenuation, shadow)) {
+                  shadow_rays.push_back(shadow.r);
+                  shadow_t.push_back(shadow.ray_t);
+                  shadow_light.push_back(path.throughput * shadow.light);
+                  shadow_pixel.push_back(path.pixel);
+                }
+                path.bsdf_pdf =
+                    scattering_pdf(recs[k], scattered.direction());
+              }
+              path.r = scattered;
+              path.throughput = path.throughput * attenuation;
+              if (!survives_roulette(bounces + 1, path.throughput)) {
+                hist.record(roulette, bounces + 1);
+                path.depth = 0;
+              } else if (path.depth == 0) {
+                hist.record(depth_limit, max_depth);
+              }
+            }
+            path.sample = smp->save();
+          }
+        }
+
+        // Shadow stage: light reaches the hits nothing blocks.
+        if (!shadow_rays.empty()) {
+          world.occluded_batch(shadow_rays.data(), shadow_t.data(),
+                               shadow_rays.size(), blocked);
+          for (size_t k = 0; k < shadow_rays.size(); k++)
+            if (!blocked[k])
+              sums[shadow_pixel[k]] += shadow_light[k];
+        }
+
+        // Compaction stage: keep only paths that scattered and have bounces
+        // left.
+        size_t live = 0;
+        for (size_t k = 0; k < n; k++)
+          if (hits[k] && paths[k].depth > 0)
+            paths[live++] = paths[k];
+        paths.resize(live);
+      }
+    }
+
+    for (int j = t.y0; j < t.y1; j++)
+      for (int i = t.x0; i < t.x1; i++)
+        accum.at(i, j) = sums[(j - t.y0) * tile_w + (i - t.x0)];
+    stats.merge(hist);
+  }
+
+  // Renders samples [0, samples_per_pixel) in passes, resuming from and
+  // saving checkpoints as configured, and writes the averages to image.
+  void render_passes(const hittable &world, framebuffer &image,
+                     render_stats &stats) const {
+    framebuffer accum(image_width, image_height);
+    int done = 0;
+    auto settings = settings_hash();
+    if (!checkpoint_path.empty() &&
+        checkpoint::load(checkpoint_path, settings, accum, done))
+      std::clog << "Resuming from " << checkpoint_path << " at " << done
+                << " samples per pixel\n";
+
+    std::unique_ptr<process_pool> workers;
+    if (num_workers > 0)
+      workers = start_workers(world);
+
+    int pass = pass_samples > 0 ? pass_samples : samples_per_pixel;
+    int passes = 0;
+    while (done < samples_per_pixel) {
+      int end = std::min(done + pass, samples_per_pixel);
+      if (workers)
+        render_tiles_distributed(world, *workers, accum, done, end, stats);
+      else
+        render_tiles(world, accum, done, end, stats);
+      stats.samples += uint64_t(end - done) * image_width * image_height;
+      done = end;
+      passes++;
+
+      if (pass_samples > 0) {
+        std::clog << "\rPass " << passes << ": " << done << '/'
+                  << samples_per_pixel << " samples per pixel\n";
+        if (!preview_path.empty()) {
+          framebuffer preview(image_width, image_height);
+          average(accum, done, preview);
+          if (!image_writer::write(preview, output_format, preview_path))
+            std::clog << "Failed to write the preview to " << preview_path
+                      << '\n';
+        }
+      }
+      if (!checkpoint_path.empty() &&
+          (passes % std::max(checkpoint_interval, 1) == 0 ||
+           done == samples_per_pixel) &&
+          !checkpoint::save(checkpoint_path, accum, done, settings))
+        std::clog << "Failed to write the checkpoint to " << checkpoint_path
+                  << '\n';
+    }
+    // A checkpoint of a longer render may hold more samples than asked for.
+    average(accum, std::max(done, 1), image);
+  }
+
+  static void average(const framebuffer &sums, int samples,
+                      framebuffer &image) {
+    auto scale = 1.0 / samples;
+    for (size_t k = 0; k < sums.pixels.size(); k++)
+      image.pixels[k] = sums.pixels[k] * scale;
+  }
+
+  // Everything that changes the value of a sample. A checkpoint written
+  // under different settings cannot be resumed.
+  uint64_t settings_hash() const {
+    auto bits = [](double x) {
+      uint64_t b;
+      std::memcpy(&b, &x, sizeof(b));
+      return b;
+    };
+    uint64_t h = mix_bits(uint64_t(image_width) << 32 | uint32_t(image_height));
+    std::initializer_list<double> values = {
+        aspect_ratio, vfov,        defocus_angle, focus_dist,
+        lookfrom.x(), lookfrom.y(), lookfrom.z(), lookat.x(),
+        lookat.y(),   lookat.z(),   vup.x(),      vup.y(),
+        vup.z()};
+    for (double x : values)
+      h = hash_combine(h, bits(x));
+    h = hash_combine(h, sizeof(real)); // Float and double renders differ.
+    h = hash_combine(h, uint64_t(max_depth));
+    h = hash_combine(h, uint64_t(seed));
+    h = hash_combine(h, uint64_t(sampling));
+    h = hash_combine(h, russian_roulette ? uint64_t(roulette_min_depth) : 0);
+    // Settings added later only change the hash when in use, so checkpoints
+    // written before them still resume.
+    if (sample_lights())
+      h = hash_combine(h, scene_lights->size());
+    if (sky_brightness != 1)
+      h = hash_combine(h, bits(sky_brightness));
+    return h;
+  }
+
+  // A distributed job: the tile index and sample range, followed by the
+  // tile's sums as doubles, row by row. The reply is just the new sums.
+  struct tile_job {
+    uint32_t tile;
+    int32_t begin_sample;
+    int32_t end_sample;
+  };
+
+  static void put_sums(const framebuffer &sums, const tile &t,
+                       process_pool::message &out) {
+    for (int j = t.y0; j < t.y1; j++) {
+      for (int i = t.x0; i < t.x1; i++) {
+        const color &c = sums.at(i, j);
+        double rgb[3] = {c.x(), c.y(), c.z()};
+        auto bytes = reinterpret_cast<const unsigned char *>(rgb);
+        out.insert(out.end(), bytes, bytes + sizeof(rgb));
+      }
+    }
+  }
+
+  static bool get_sums(const unsigned char *in, size_t size, const tile &t,
+                       framebuffer &sums) {
+    size_t pixels = size_t(t.x1 - t.x0) * (t.y1 - t.y0);
+    if (size != pixels * 3 * sizeof(double))
+      return false;
+    for (int j = t.y0; j < t.y1; j++) {
+      for (int i = t.x0; i < t.x1; i++) {
+        double rgb[3];
+        std::memcpy(rgb, in, sizeof(rgb));
+        in += sizeof(rgb);
+        sums.at(i, j) = color(rgb[0], rgb[1], rgb[2]);
+      }
+    }
+    return true;
+  }
+
+  // Forks the workers. Everything a worker needs (the scene, this camera,
+  // the tile list) is already in its copy of the address space.
+  std::unique_ptr<process_pool> start_workers(const hittable &world) const {
+    auto handler = [this, &world, tiles = make_tiles(),
+                    sums = framebuffer(image_width, image_height)](
+                       const process_pool::message &job) mutable {
+      process_pool::message reply;
+      tile_job head;
+      if (job.size() < sizeof(head))
+        return reply;
+      std::memcpy(&head, job.data(), sizeof(head));
+      const tile &t = tiles.at(head.tile);
+      if (!get_sums(job.data() + sizeof(head), job.size() - sizeof(head), t,
+                    sums))
+        return reply;
+      render_stats stats;
+      render_tile_range(world, t, sums, head.begin_sample, head.end_sample,
+                        stats);
+      put_sums(sums, t, reply);
+      return reply;
+    };
+    std::clog << "Starting " << num_workers << " worker processes\n";
+    return std::make_unique<process_pool>(num_workers, handler);
+  }
+
+  void render_tiles_distributed(const hittable &world, process_pool &workers,
+                                framebuffer &accum, int begin_sample,
+                                int end_sample, render_stats &stats) const {
+    auto tiles = make_tiles();
+    std::vector<process_pool::message> jobs(tiles.size());
+    for (size_t index = 0; index < tiles.size(); index++) {
+      tile_job head = {uint32_t(index), begin_sample, end_sample};
+      auto bytes = reinterpret_cast<const unsigned char *>(&head);
+      jobs[index].assign(bytes, bytes + sizeof(head));
+      put_sums(accum, tiles[index], jobs[index]);
+    }
+
+    std::vector<bool> finished(tiles.size(), false);
+    size_t count = 0;
+    int last_percent = -1;
+    workers.run(jobs, [&](size_t index, const process_pool::message &reply) {
+      if (!get_sums(reply.data(), reply.size(), tiles[index], accum))
+        return;
+      finished[index] = true;
+      int percent = int(100 * ++count / tiles.size());
+      if (percent != last_percent) {
+        last_percent = percent;
+        std::clog << "\rRendering: " << percent << "% " << std::flush;
+      }
+    });
+
+    // Tiles are missing when their job kept killing workers, or when no
+    // worker could be started at all. Rendering them here, on this
+    // process's threads, still gives a complete image.
+    std::vector<size_t> missing;
+    for (size_t index = 0; index < tiles.size(); index++) {
+      if (!finished[index]) {
+        std::clog << "\rTile " << index << " failed in the workers, "
+                  << "rendering it locally\n";
+        missing.push_back(index);
+      }
+    }
+    if (!missing.empty())
+      render_tiles(world, accum, begin_sample, end_sample, stats, missing);
+  }
+
+  void render_tile_range(const hittable &world, const tile &t,
+                         framebuffer &accum, int begin_sample, int end_sample,
+                         render_stats &stats) const {
+    if (wavefront)
+      render_tile_wavefront(world, t, accum, begin_sample, end_sample, stats);
+    else if (packet_primary)
+      render_tile_packets(world, t, accum, begin_sample, end_sample, stats);
+    else
+      render_tile(world, t, accum, begin_sample, end_sample, stats);
+  }
+
+  void render_tiles(const hittable &world, framebuffer &image,
+                    int begin_sample, int end_sample,
+                    render_stats &stats) const {
+    std::vector<size_t> all(make_tiles().size());
+    for (size_t index = 0; index < all.size(); index++)
+      all[index] = index;
+    render_tiles(world, image, begin_sample, end_sample, stats, all);
+  }
+
+  // Renders only the tiles whose indices are listed.
+  void render_tiles(const hittable &world, framebuffer &image,
+                    int begin_sample, int end_sample, render_stats &stats,
+                    const std::vector<size_t> &indices) const {
+    auto tiles = make_tiles();
+    std::atomic<size_t> finished(0);
+    std::atomic<int> last_percent(-1);
+    std::mutex log_mutex;
+
+    auto run_tile = [&](size_t index) {
+#ifdef RTWEEKEND_STATS
+      auto counters_before = trace_counters::local();
+      auto tile_start = std::chrono::steady_clock::now();
+#endif
+      if (adaptive_sampling)
+        render_tile_adaptive(world, tiles[index], image, stats);
+      else
+        render_tile_range(world, tiles[index], image, begin_sample,
+                          end_sample, stats);
+#ifdef RTWEEKEND_STATS
+      std::chrono::duration<double> tile_time =
+          std::chrono::steady_clock::now() - tile_start;
+      stats.merge_trace(index, tile_time.count(),
+                        trace_counters::local() - counters_before);
+#endif
+      // Only log when the percentage changes, not for every tile.
+      int percent = int(100 * ++finished / indices.size());
+      if (last_percent.exchange(percent) != percent) {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::clog << "\rRendering: " << percent << "% " << std::flush;
+      }
+    };
+
+#ifdef RTWEEKEND_STATS
+    auto start = std::chrono::steady_clock::now();
+#endif
+    if (num_threads == 1) {
+      for (size_t index : indices)
+        run_tile(index);
+    } else {
+      thread_pool &workers = tile_pool();
+      for (size_t index : indices)
+        workers.submit([&run_tile, index] { run_tile(index); });
+      workers.wait();
+    }
+#ifdef RTWEEKEND_STATS
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    stats.trace.tiles_seconds += elapsed.count();
+#endif
+  }
+
+  thread_pool &tile_pool() const {
+    int n = num_threads < 1 ? thread_pool::default_thread_count() : num_threads;
+    auto &own = pool.own_pool;
+    if (!own || own->size() != n)
+      own = std::make_unique<thread_pool>(n);
+    return *own;
+  }
+
   void initialize() {
     // Image
     image_height = int(image_width / aspect_ratio);
@@ -109,51 +1137,210 @@ private:
     defocus_disk_v = v * defocus_radius;
   }
 
-  color ray_color(const ray &r, int depth, const hittable &world) const {
-    if (depth <= 0)
-      return color(0, 0, 0);
-
+  // Traces a path of at most depth bounces. Rather than recursing and
+  // multiplying attenuations on the way back up, the loop carries the path's
+  // throughput (the product of the attenuations so far) forward. If first_hit
+  // is given it is the already known closest hit of r, e.g. from a packet.
+  color ray_color(ray r, int depth, const hittable &world,
+                  path_histogram &hist,
+                  const hit_record *first_hit = nullptr) const {
+    color radiance(0, 0, 0);
+    color throughput(1, 1, 1);
+    double bsdf_pdf = 0; // Of the last bounce, see emission_weight().
     hit_record rec;
-    // Ignore rays which hit very close to the point due to floating point
-    // approximations.
-    if (world.hit(r, interval(0.001, infinity), rec)) {
+
+    for (int bounce = 0;; bounce++) {
+      if (bounce >= depth) {
+        hist.record(depth_limit, bounce);
+        return radiance;
+      }
+
+      // Ignore rays which hit very close to the point due to floating point
+      // approximations.
+      if (bounce == 0 && first_hit) {
+        rec = *first_hit;
+      } else if (!world.hit(r, interval(0.001, infinity), rec)) {
+        hist.record(escaped, bounce);
+        return radiance + throughput * background(r);
+      }
+
+      color emission = emitted(rec);
+      if (!is_black(emission))
+        radiance += throughput * emission * emission_weight(bsdf_pdf, r, rec);
+
       ray scattered;
       color attenuation;
+      if (!scatter(r, rec, attenuation, scattered)) {
+        hist.record(absorbed, bounce);
+        return radiance;
+      }
 
-      if (rec.mat->scatter(r, rec, attenuation, scattered)) {
-        return attenuation * ray_color(scattered, depth - 1, world);
+      // Light is sampled only where the next bounce could still find it, so
+      // both strategies always cover the same paths.
+      bsdf_pdf = 0;
+      if (bounce + 1 < depth && sample_lights()) {
+        radiance += throughput * direct_light(world, rec, attenuation);
+        bsdf_pdf = scattering_pdf(rec, scattered.direction());
       }
+
+      throughput = throughput * attenuation;
+      if (!survives_roulette(bounce + 1, throughput)) {
+        hist.record(roulette, bounce + 1);
+        return radiance;
+      }
+      r = scattered;
+    }
+  }
+
+  bool sample_lights() const {
+    return light_sampling && scene_lights && !scene_lights->empty();
+  }
+
+  static bool is_black(const color &c) {
+    return c.x() == 0 && c.y() == 0 && c.z() == 0;
+  }
+
+  // A ray from a hit towards a light, and the light it brings if nothing is
+  // in the way.
+  struct shadow_ray {
+    ray r;
+    interval ray_t;
+    color light;
+  };
+
+  // Samples a light at a hit. Its light is weighted against the chance that
+  // the material's own sample finds the same light; attenuation * bsdf_pdf
+  // is the BSDF times the cosine there (see material::scattering_pdf).
+  // False if the sample cannot add anything.
+  bool sample_light(const hit_record &rec, const color &attenuation,
+                    shadow_ray &out) const {
+    light_list::light_sample light;
+    double u_light = sample_1d();
+    if (!scene_lights->sample(rec.p, u_light, sample_2d(), light))
+      return false;
+    double bsdf_pdf = scattering_pdf(rec, light.direction);
+    if (bsdf_pdf <= 0)
+      return false;
+    // Power heuristic weight over the light's pdf.
+    double weight =
+        light.pdf / (light.pdf * light.pdf + bsdf_pdf * bsdf_pdf);
+    out.r = ray(rec.p, light.direction);
+    out.ray_t = interval(0.001, light.distance - 0.001);
+    out.light = attenuation * light.radiance * (bsdf_pdf * weight);
+    return true;
+  }
+
+  color direct_light(const hittable &world, const hit_record &rec,
+                     const color &attenuation) const {
+    shadow_ray shadow;
+    if (!sample_light(rec, attenuation, shadow) ||
+        world.occluded(shadow.r, shadow.ray_t))
       return color(0, 0, 0);
+    return shadow.light;
+  }
+
+  // The weight of light found by a ray that a material scattered with
+  // density bsdf_pdf, against the chance that sampling the lights from the
+  // ray's origin picks the same direction. 1 where the lights were not
+  // sampled (bsdf_pdf 0), e.g. for camera rays and off mirrors.
+  double emission_weight(double bsdf_pdf, const ray &r,
+                         const hit_record &rec) const {
+    if (bsdf_pdf <= 0)
+      return 1;
+    double light_pdf = scene_lights->pdf(r.origin(), rec.p);
+    return bsdf_pdf * bsdf_pdf /
+           (bsdf_pdf * bsdf_pdf + light_pdf * light_pdf);
+  }
+
+  bool converged(int n, double mean, double m2) const {
+    if (n < 2)
+      return false;
+    auto variance = m2 / (n - 1);
+    auto half_width = 1.96 * std::sqrt(variance / n);
+    return half_width <= adaptive_threshold * std::fmax(mean, 0.01);
+  }
+
+  // Blue for 0, through green, to red for 1.
+  static color heat(double t) {
+    auto c = color(t, 1 - std::fabs(2 * t - 1), 1 - t);
+    return c * c; // Undo the gamma applied by the writer.
+  }
+
+  void write_sample_heatmap(const std::vector<int> &counts) const {
+    // Blue for pixels that stopped after the first batch, to red for pixels
+    // that used the whole samples_per_pixel budget.
+    framebuffer heatmap(image_width, image_height);
+    for (size_t k = 0; k < counts.size(); k++)
+      heatmap.pixels[k] = heat(double(counts[k]) / samples_per_pixel);
+    image_writer::write(heatmap, image_format::ppm, sample_heatmap_path);
+  }
+
+  // Every tile is filled with its time relative to the slowest tile.
+  void write_tile_heatmap(const std::vector<double> &seconds) const {
+    auto tiles = make_tiles();
+    double slowest = 0;
+    for (auto t : seconds)
+      slowest = std::max(slowest, t);
+    framebuffer heatmap(image_width, image_height);
+    for (size_t index = 0; index < tiles.size() && index < seconds.size();
+         index++) {
+      const tile &t = tiles[index];
+      color c = heat(slowest > 0 ? seconds[index] / slowest : 0);
+      for (int j = t.y0; j < t.y1; j++)
+        for (int i = t.x0; i < t.x1; i++)
+          heatmap.at(i, j) = c;
     }
+    if (!image_writer::write(heatmap, image_format::ppm, tile_heatmap_path))
+      std::clog << "Failed to write the tile heatmap to " << tile_heatmap_path
+                << '\n';
+  }
+
+  bool survives_roulette(int bounces, color &throughput) const {
+    if (!russian_roulette || bounces < roulette_min_depth)
+      return true;
+    auto p = std::fmin(0.95, std::fmax(throughput.x(),
+                                       std::fmax(throughput.y(),
+                                                 throughput.z())));
+    if (sample_1d() >= p)
+      return false;
+    throughput /= p;
+    return true;
+  }
 
+  color background(const ray &r) const {
     // Skybox background
     vec3 unit_direction = unit_vector(r.direction());
     auto a = 0.5 * (unit_direction.y() + 1.0);
-    return (1.0 - a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0);
+    return sky_brightness *
+           ((1.0 - a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0));
   }
 
-  ray get_ray(int i, int j) const {
+  ray get_ray(int i, int j, sampler &smp) const {
     // Create a ray from camera origin to pixel (i,j) with random samples around
     // the pixel location.
 
-    auto offset = sample_square();
+    auto offset = sample_square(smp);
     auto pixel_sample = pixel00_loc + ((i + offset.x()) * pixel_delta_x) +
                         ((j + offset.y()) * pixel_delta_y);
     auto ray_origin =
-        (defocus_angle <= 0) ? camera_center : defocus_disk_sample();
+        (defocus_angle <= 0) ? camera_center : defocus_disk_sample(smp);
     auto ray_direction = pixel_sample - ray_origin;
     return ray(ray_origin, ray_direction);
   }
 
-  vec3 sample_square() const {
+  vec3 sample_square(sampler &smp) const {
     // Return a random vector in the [-0.5, -0.5] - [0.5, 0.5] unit square for
     // anti-aliasing.
-    return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+    auto u = smp.get_2d();
+    return vec3(u.x() - 0.5, u.y() - 0.5, 0);
   }
 
-  point3 defocus_disk_sample() const {
-    // Return a random point on the camera defocus disk
-    auto p = random_in_unit_disk();
+  point3 defocus_disk_sample(sampler &smp) const {
+    // Return a random point on the camera defocus disk. The concentric map
+    // uses the sampler's lens dimensions as they are, so the lens samples
+    // stay stratified.
+    auto u = smp.get_2d();
+    auto p = concentric_disk(real(u.x()), real(u.y()));
     return camera_center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
   }
 };
@@ -0,0 +1,97 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "framebuffer.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Checkpoint of a progressive render: a small fixed header followed by the
+// running per-pixel sample sums as raw doubles (r, g, b per pixel, top row
+// first). Since every sample is a pure function of (seed, pixel, sample
+// index), the number of samples already summed is all the random number
+// state there is to save, and a resumed render ends up with the exact sums of
+// an uninterrupted one.
+//
+// The settings hash covers the camera and integrator settings; it does not
+// cover the scene, so resuming with a different world is not detected.
+class checkpoint {
+public:
+  struct header {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t samples_done;
+    uint32_t reserved;
+    uint64_t settings_hash;
+  };
+
+  // Writes to a temporary file first and renames it over path, so a job that
+  // is killed mid-write still leaves the previous checkpoint intact.
+  static bool save(const std::string &path, const framebuffer &sums,
+                   int samples_done, uint64_t settings_hash) {
+    header head = {};
+    std::memcpy(head.magic, file_magic, sizeof(head.magic));
+    head.width = uint32_t(sums.width);
+    head.height = uint32_t(sums.height);
+    head.samples_done = uint32_t(samples_done);
+    head.settings_hash = settings_hash;
+
+    std::string temp_path = path + ".tmp";
+    auto file = mapped_file::create(temp_path, file_size(sums));
+    if (!file.is_open())
+      return false;
+
+    unsigned char *out = file.data();
+    std::memcpy(out, &head, sizeof(head));
+    out += sizeof(head);
+    for (const auto &pixel : sums.pixels) {
+      double rgb[3] = {pixel.x(), pixel.y(), pixel.z()};
+      std::memcpy(out, rgb, sizeof(rgb));
+      out += sizeof(rgb);
+    }
+
+    if (!file.close())
+      return false;
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+  }
+
+  // Loads the sums into a framebuffer that is already sized for the render.
+  // Returns false, leaving sums untouched, if there is no usable checkpoint.
+  static bool load(const std::string &path, uint64_t settings_hash,
+                   framebuffer &sums, int &samples_done) {
+    auto file = mapped_file::open_read(path);
+    if (!file.is_open() || file.size() != file_size(sums))
+      return false;
+
+    header head;
+    std::memcpy(&head, file.data(), sizeof(head));
+    if (std::memcmp(head.magic, file_magic, sizeof(head.magic)) != 0 ||
+        head.width != uint32_t(sums.width) ||
+        head.height != uint32_t(sums.height) ||
+        head.settings_hash != settings_hash)
+      return false;
+
+    const unsigned char *in = file.data() + sizeof(head);
+    for (auto &pixel : sums.pixels) {
+      double rgb[3];
+      std::memcpy(rgb, in, sizeof(rgb));
+      in += sizeof(rgb);
+      pixel = color(rgb[0], rgb[1], rgb[2]);
+    }
+    samples_done = int(head.samples_done);
+    return true;
+  }
+
+private:
+  static constexpr char file_magic[8] = {'R', 'T', 'C', 'K', 'P', 'T', 0, 1};
+
+  static size_t file_size(const framebuffer &sums) {
+    return sizeof(header) + 3 * sizeof(double) * sums.pixels.size();
+  }
+};
+
+#endif // !CHECKPOINT_H
@@ -6,27 +6,29 @@
 
 using color = vec3;
 
-inline double linear_to_gamma(double linear_component) {
+inline real linear_to_gamma(real linear_component) {
   if (linear_component > 0)
     return std::sqrt(linear_component);
 
   return 0;
 }
 
-void write_color(std::ostream &out, const color &pixel_color) {
-  auto r = pixel_color.x();
-  auto g = pixel_color.y();
-  auto b = pixel_color.z();
-
-  r = linear_to_gamma(r);
-  g = linear_to_gamma(g);
-  b = linear_to_gamma(b);
+// Relative luminance of a linear color (Rec. 709 weights).
+inline real luminance(const color &c) {
+  return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
 
+// Gamma corrects a linear color component and quantizes it to [0,255].
+inline int component_to_byte(real linear_component) {
   // Translate [0,1] values to [0,255]
   static const interval intensity(0.000, 0.999);
-  int rbyte = int(256 * intensity.clamp(r));
-  int gbyte = int(256 * intensity.clamp(g));
-  int bbyte = int(256 * intensity.clamp(b));
+  return int(256 * intensity.clamp(linear_to_gamma(linear_component)));
+}
+
+void write_color(std::ostream &out, const color &pixel_color) {
+  int rbyte = component_to_byte(pixel_color.x());
+  int gbyte = component_to_byte(pixel_color.y());
+  int bbyte = component_to_byte(pixel_color.z());
 
   // Write out pixel values to stdout
   out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
@@ -0,0 +1,669 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "sphere_soup.h"
+#include "trace_stats.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// One node of a flat_bvh, packed into 32 bytes so two nodes share a cache
+// line. Bounds are stored as floats, rounded outwards so the box still
+// encloses its contents.
+struct alignas(32) flat_bvh_node {
+  float bounds_min[3];
+  float bounds_max[3];
+  // Leaves: index of the first primitive. Interior nodes: index of the second
+  // child (the first child always directly follows its parent).
+  uint32_t offset;
+  uint16_t primitive_count; // 0 for interior nodes.
+  uint8_t axis;             // Split axis of interior nodes.
+  uint8_t pad;
+
+  bool is_leaf() const { return primitive_count > 0; }
+};
+
+static_assert(sizeof(flat_bvh_node) == 32, "flat_bvh_node must be 32 bytes");
+
+// Bounding volume hierarchy compiled into one contiguous array of nodes in
+// depth-first order. Traversal is an iterative loop with a small fixed stack
+// that visits the child nearer to the ray origin first, and leaves refer to a
+// contiguous run of primitives by index. Compared with bvh_node there is no
+// pointer chasing or virtual call per interior node, and no shared_ptr
+// copies at all on the hit path.
+//
+// When the list holds only spheres, the leaves are stored in a sphere_soup
+// instead, each leaf starting on a block boundary, so a leaf of up to four
+// spheres is a single SIMD test. Trees over a triangle_mesh keep their
+// leaves the same way, in a copy of the mesh in leaf order.
+//
+// Like sphere_soup, traversal reads the nodes through a pointer, so a tree
+// can also run over nodes it does not own, e.g. from a scene cache.
+class flat_bvh : public hittable {
+public:
+  flat_bvh(const hittable_list &list) {
+    owned = list.objects;
+    if (sphere_soup::holds_only_spheres(list))
+      soup = std::make_unique<sphere_soup>();
+
+    std::vector<build_item> items;
+    items.reserve(owned.size());
+    for (size_t i = 0; i < owned.size(); i++) {
+      auto box = owned[i]->bounding_box();
+      items.push_back({box, box.centroid(), uint32_t(i)});
+    }
+
+    primitives.reserve(owned.size());
+    if (!items.empty()) {
+      own_nodes.reserve(2 * items.size());
+      build(items, 0, items.size(), 0);
+    }
+    point_at_own_nodes();
+    bbox = list.bounding_box();
+  }
+
+  // Builds over the spheres of a soup, into a new soup in leaf order that
+  // shares its material table.
+  flat_bvh(const sphere_soup &spheres) : source(&spheres) {
+    soup = std::make_unique<sphere_soup>();
+    soup->share_materials(spheres);
+
+    std::vector<build_item> items;
+    items.reserve(spheres.size());
+    for (size_t i = 0; i < spheres.size(); i++) {
+      point3 center;
+      double radius;
+      uint32_t material;
+      if (!spheres.sphere_at(i, center, radius, material))
+        continue;
+      auto rvec = vec3(radius, radius, radius);
+      aabb box(center - rvec, center + rvec);
+      items.push_back({box, box.centroid(), uint32_t(i)});
+    }
+
+    if (!items.empty()) {
+      own_nodes.reserve(2 * items.size());
+      build(items, 0, items.size(), 0);
+    }
+    point_at_own_nodes();
+    bbox = spheres.bounding_box();
+    source = nullptr;
+  }
+
+  // Builds over the triangles of a mesh, into a new mesh in leaf order that
+  // shares its vertices, normals and material.
+  flat_bvh(const triangle_mesh &mesh) : mesh_source(&mesh) {
+    triangles = std::make_unique<triangle_mesh>();
+    triangles->share_buffers(mesh);
+
+    std::vector<build_item> items;
+    items.reserve(mesh.size());
+    for (size_t i = 0; i < mesh.size(); i++) {
+      aabb box;
+      if (mesh.triangle_bounds(i, box))
+        items.push_back({box, box.centroid(), uint32_t(i)});
+    }
+
+    if (!items.empty()) {
+      own_nodes.reserve(2 * items.size());
+      build(items, 0, items.size(), 0);
+    }
+    point_at_own_nodes();
+    bbox = mesh.bounding_box();
+    mesh_source = nullptr;
+  }
+
+  // A tree over nodes and leaves it does not own; the nodes must outlive it
+  // and pass valid_soup_nodes() for the leaves.
+  flat_bvh(const flat_bvh_node *nodes, size_t count,
+           std::unique_ptr<sphere_soup> leaves, const aabb &bounds)
+      : soup(std::move(leaves)), nodes(nodes), nodes_size(count),
+        bbox(bounds) {}
+
+  // Whether count nodes read from elsewhere (e.g. a scene cache) are a tree
+  // in the layout the constructors build, over a soup of `lanes` lanes, that
+  // traversal can walk without leaving the nodes, the soup or its stack:
+  // every subtree fills a contiguous range, with the first child right after
+  // its parent; leaves cover whole blocks of spheres that exist; and the
+  // tree is no deeper than max_stack.
+  static bool valid_soup_nodes(const flat_bvh_node *nodes, size_t count,
+                               size_t lanes) {
+    return count == 0 || valid_subtree(nodes, 0, count, lanes, 0);
+  }
+
+  flat_bvh(const flat_bvh &) = delete;
+  flat_bvh &operator=(const flat_bvh &) = delete;
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    if (nodes_size == 0)
+      return false;
+
+    const point3 &orig = r.origin();
+    const vec3 &dir = r.direction();
+    const real inv_dir[3] = {1 / dir[0], 1 / dir[1], 1 / dir[2]};
+    const bool dir_is_neg[3] = {inv_dir[0] < 0, inv_dir[1] < 0,
+                                inv_dir[2] < 0};
+
+    uint32_t stack[max_stack];
+    int stack_size = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+
+    while (true) {
+      const flat_bvh_node &node = nodes[current];
+      if (box_hit(node, orig, inv_dir, ray_t)) {
+        if (node.is_leaf()) {
+          if (leaf_hit(node, r, ray_t, rec)) {
+            hit_anything = true;
+            ray_t.max = rec.t;
+          }
+        } else if (dir_is_neg[node.axis]) {
+          // The second child lies on the near side, visit it first.
+          stack[stack_size++] = current + 1;
+          current = node.offset;
+          continue;
+        } else {
+          stack[stack_size++] = node.offset;
+          current = current + 1;
+          continue;
+        }
+      }
+      if (stack_size == 0)
+        break;
+      current = stack[--stack_size];
+    }
+
+    return hit_anything;
+  }
+
+  // The same walk, which ends at the first leaf with a hit.
+  bool occluded(const ray &r, interval ray_t) const override {
+    if (nodes_size == 0)
+      return false;
+
+    const point3 &orig = r.origin();
+    const vec3 &dir = r.direction();
+    const real inv_dir[3] = {1 / dir[0], 1 / dir[1], 1 / dir[2]};
+    const bool dir_is_neg[3] = {inv_dir[0] < 0, inv_dir[1] < 0,
+                                inv_dir[2] < 0};
+
+    uint32_t stack[max_stack];
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while (true) {
+      const flat_bvh_node &node = nodes[current];
+      if (box_hit(node, orig, inv_dir, ray_t)) {
+        if (node.is_leaf()) {
+          if (leaf_occluded(node, r, ray_t))
+            return true;
+        } else if (dir_is_neg[node.axis]) {
+          stack[stack_size++] = current + 1;
+          current = node.offset;
+          continue;
+        } else {
+          stack[stack_size++] = node.offset;
+          current = current + 1;
+          continue;
+        }
+      }
+      if (stack_size == 0)
+        break;
+      current = stack[--stack_size];
+    }
+    return false;
+  }
+
+  // Each ray walks the tree on its own: shadow rays start from different
+  // points and rarely share much of a path, unlike the camera rays of a
+  // packet. The batch saves a virtual call per ray.
+  void occluded_batch(const ray *rays, const interval *ray_t, size_t count,
+                      bool *blocked) const override {
+    for (size_t k = 0; k < count; k++)
+      blocked[k] = flat_bvh::occluded(rays[k], ray_t[k]);
+  }
+
+  // Packet traversal. All rays of the packet walk the tree together, and a
+  // node is skipped for the whole packet when interval arithmetic over the
+  // packet's origins and inverse directions proves that no ray can enter its
+  // box (a conservative frustum test that also works for the jittered,
+  // defocused rays of a pixel block). Packets whose direction signs disagree
+  // on some axis fall back to testing the rays one by one at each node.
+  // Leaves run the SIMD sphere test per ray.
+  void hit_packet(ray_packet &packet) const override {
+    for (int k = 0; k < packet.count; k++)
+      packet.hit[k] = false;
+    if (nodes_size == 0 || packet.count == 0)
+      return;
+
+    int n = packet.count;
+    real inv_dir[ray_packet::max_size][3];
+    packet_bounds pb;
+    pb.coherent = true;
+    for (int axis = 0; axis < 3; axis++) {
+      pb.o_min[axis] = pb.inv_min[axis] = infinity;
+      pb.o_max[axis] = pb.inv_max[axis] = -infinity;
+    }
+    pb.t_min = infinity;
+    double t_max = -infinity;
+
+    for (int k = 0; k < n; k++) {
+      const point3 &o = packet.rays[k].origin();
+      const vec3 &d = packet.rays[k].direction();
+      for (int axis = 0; axis < 3; axis++) {
+        inv_dir[k][axis] = 1 / d[axis];
+        pb.o_min[axis] = std::fmin(pb.o_min[axis], o[axis]);
+        pb.o_max[axis] = std::fmax(pb.o_max[axis], o[axis]);
+        pb.inv_min[axis] = std::fmin(pb.inv_min[axis], inv_dir[k][axis]);
+        pb.inv_max[axis] = std::fmax(pb.inv_max[axis], inv_dir[k][axis]);
+      }
+      pb.t_min = std::fmin(pb.t_min, packet.ray_t[k].min);
+      t_max = std::fmax(t_max, packet.ray_t[k].max);
+    }
+    for (int axis = 0; axis < 3; axis++) {
+      bool same_sign = pb.inv_min[axis] > 0 || pb.inv_max[axis] < 0;
+      bool finite = std::isfinite(pb.inv_min[axis]) &&
+                    std::isfinite(pb.inv_max[axis]);
+      if (!same_sign || !finite)
+        pb.coherent = false;
+    }
+
+    // Near-first ordering follows the packet's first ray.
+    const bool dir_is_neg[3] = {inv_dir[0][0] < 0, inv_dir[0][1] < 0,
+                                inv_dir[0][2] < 0};
+
+    uint32_t stack[max_stack];
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while (true) {
+      const flat_bvh_node &node = nodes[current];
+      bool visit = pb.coherent ? packet_may_hit(node, pb, t_max)
+                               : any_ray_hits(node, packet, inv_dir);
+      if (visit) {
+        if (node.is_leaf()) {
+          t_max = -infinity;
+          for (int k = 0; k < n; k++) {
+            const point3 &o = packet.rays[k].origin();
+            auto &ray_t = packet.ray_t[k];
+            if (box_hit(node, o, inv_dir[k], ray_t) &&
+                leaf_hit(node, packet.rays[k], ray_t, packet.rec[k])) {
+              packet.hit[k] = true;
+              ray_t.max = packet.rec[k].t;
+            }
+            t_max = std::fmax(t_max, ray_t.max);
+          }
+        } else if (dir_is_neg[node.axis]) {
+          stack[stack_size++] = current + 1;
+          current = node.offset;
+          continue;
+        } else {
+          stack[stack_size++] = node.offset;
+          current = current + 1;
+          continue;
+        }
+      }
+      if (stack_size == 0)
+        break;
+      current = stack[--stack_size];
+    }
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  // Updates the tree after objects of the list it was built from moved (see
+  // sphere::move_to): leaves recompute their bounds, and their sphere_soup
+  // lanes, from the objects, then every interior node takes the union of its
+  // children. The topology stays as built, so this costs a fraction of a
+  // rebuild but traversal slows down as objects drift far from where they
+  // were at build time. False for trees that were not built from a list and
+  // have nothing to refit from.
+  bool refit() {
+    if (owned.empty())
+      return nodes_size == 0;
+
+    // Children always come after their parent, so a reverse sweep sees both
+    // children of a node before the node itself.
+    for (size_t k = own_nodes.size(); k-- > 0;) {
+      flat_bvh_node &node = own_nodes[k];
+      if (node.is_leaf()) {
+        aabb box;
+        for (uint32_t i = node.offset; i < node.offset + node.primitive_count;
+             i++) {
+          if (soup) {
+            const auto &object = *owned[leaf_objects[i]];
+            const auto &s = static_cast<const sphere &>(object);
+            soup->set_center(i, s.center());
+            box = aabb(box, s.bounding_box());
+          } else {
+            box = aabb(box, primitives[i]->bounding_box());
+          }
+        }
+        set_bounds(node, box);
+        continue;
+      }
+      const flat_bvh_node &first = own_nodes[k + 1];
+      const flat_bvh_node &second = own_nodes[node.offset];
+      for (int axis = 0; axis < 3; axis++) {
+        node.bounds_min[axis] =
+            std::min(first.bounds_min[axis], second.bounds_min[axis]);
+        node.bounds_max[axis] =
+            std::max(first.bounds_max[axis], second.bounds_max[axis]);
+      }
+    }
+
+    bbox = aabb();
+    for (const auto &object : owned)
+      bbox = aabb(bbox, object->bounding_box());
+    return true;
+  }
+
+  size_t node_count() const { return nodes_size; }
+  const flat_bvh_node *node_data() const { return nodes; }
+
+  // The leaves, when they are a sphere_soup; null otherwise.
+  const sphere_soup *sphere_leaves() const { return soup.get(); }
+
+private:
+  // Nodes past this depth are split at the median object, which bounds the
+  // tree depth (and thus the traversal stack) at max_sah_depth + 32.
+  static constexpr int max_sah_depth = 32;
+  static constexpr int max_stack = max_sah_depth + 32;
+  static constexpr size_t max_leaf_size = 4;
+  static constexpr int sah_bins = 16;
+
+  // Whether node `first` heads a subtree that fills [first, end).
+  static bool valid_subtree(const flat_bvh_node *nodes, size_t first,
+                            size_t end, size_t lanes, int depth) {
+    const flat_bvh_node &node = nodes[first];
+    if (node.is_leaf())
+      return end == first + 1 && node.offset % 4 == 0 &&
+             node.offset + size_t(node.primitive_count) <= lanes;
+    return depth < max_stack && node.axis < 3 && first + 1 < node.offset &&
+           node.offset < end &&
+           valid_subtree(nodes, first + 1, node.offset, lanes, depth + 1) &&
+           valid_subtree(nodes, node.offset, end, lanes, depth + 1);
+  }
+
+  struct build_item {
+    aabb box;
+    point3 centroid;
+    uint32_t index;
+  };
+
+  std::vector<shared_ptr<hittable>> owned;
+  std::vector<const hittable *> primitives; // Grouped by leaf.
+  std::unique_ptr<sphere_soup> soup;        // Replaces primitives if set.
+  std::unique_ptr<triangle_mesh> triangles; // Likewise.
+  std::vector<uint32_t> leaf_objects;       // Index in owned of soup lanes.
+  std::vector<flat_bvh_node> own_nodes;     // Filled by build().
+  const flat_bvh_node *nodes = nullptr;     // Depth-first order.
+  size_t nodes_size = 0;
+  aabb bbox;
+  const sphere_soup *source = nullptr; // Spheres being built over, if any.
+  const triangle_mesh *mesh_source = nullptr; // Likewise for triangles.
+
+  void point_at_own_nodes() {
+    nodes = own_nodes.data();
+    nodes_size = own_nodes.size();
+  }
+
+  // Ranges over all rays of a packet. Only meaningful when coherent, i.e.
+  // when on every axis all inverse directions are finite with the same sign.
+  struct packet_bounds {
+    double o_min[3], o_max[3];
+    double inv_min[3], inv_max[3];
+    double t_min;
+    bool coherent;
+  };
+
+  bool leaf_hit(const flat_bvh_node &node, const ray &r, interval ray_t,
+                hit_record &rec) const {
+    if (soup)
+      return soup->hit_range(r, node.offset, node.primitive_count, ray_t, rec);
+    if (triangles)
+      return triangles->hit_range(r, node.offset, node.primitive_count, ray_t,
+                                  rec);
+
+    bool hit_anything = false;
+    for (uint32_t i = 0; i < node.primitive_count; i++) {
+      if (primitives[node.offset + i]->hit(r, ray_t, rec)) {
+        hit_anything = true;
+        ray_t.max = rec.t;
+      }
+    }
+    return hit_anything;
+  }
+
+  bool leaf_occluded(const flat_bvh_node &node, const ray &r,
+                     interval ray_t) const {
+    if (soup)
+      return soup->occluded_range(r, node.offset, node.primitive_count,
+                                  ray_t);
+    if (triangles)
+      return triangles->occluded_range(r, node.offset, node.primitive_count,
+                                       ray_t);
+    for (uint32_t i = 0; i < node.primitive_count; i++)
+      if (primitives[node.offset + i]->occluded(r, ray_t))
+        return true;
+    return false;
+  }
+
+  static void product_range(double a_lo, double a_hi, double b_lo,
+                            double b_hi, double &lo, double &hi) {
+    double p0 = a_lo * b_lo, p1 = a_lo * b_hi;
+    double p2 = a_hi * b_lo, p3 = a_hi * b_hi;
+    lo = std::fmin(std::fmin(p0, p1), std::fmin(p2, p3));
+    hi = std::fmax(std::fmax(p0, p1), std::fmax(p2, p3));
+  }
+
+  // Conservative: false only if no ray of the packet can hit the node's box.
+  // For each ray, entry into a slab is at (plane - origin) * inv_dir, which
+  // interval arithmetic bounds over all rays at once. If the latest possible
+  // entry lower bound is past the earliest possible exit upper bound, every
+  // ray misses.
+  static bool packet_may_hit(const flat_bvh_node &node,
+                             const packet_bounds &pb, double t_max) {
+    double near_lo = pb.t_min;
+    double far_hi = t_max;
+    for (int axis = 0; axis < 3; axis++) {
+      double lo0, hi0, lo1, hi1;
+      product_range(node.bounds_min[axis] - pb.o_max[axis],
+                    node.bounds_min[axis] - pb.o_min[axis], pb.inv_min[axis],
+                    pb.inv_max[axis], lo0, hi0);
+      product_range(node.bounds_max[axis] - pb.o_max[axis],
+                    node.bounds_max[axis] - pb.o_min[axis], pb.inv_min[axis],
+                    pb.inv_max[axis], lo1, hi1);
+      bool positive = pb.inv_min[axis] > 0;
+      near_lo = std::fmax(near_lo, positive ? lo0 : lo1);
+      far_hi = std::fmin(far_hi, positive ? hi1 : hi0);
+      if (near_lo > far_hi)
+        return false;
+    }
+    return true;
+  }
+
+  bool any_ray_hits(const flat_bvh_node &node, const ray_packet &packet,
+                    const real inv_dir[][3]) const {
+    for (int k = 0; k < packet.count; k++)
+      if (box_hit(node, packet.rays[k].origin(), inv_dir[k], packet.ray_t[k]))
+        return true;
+    return false;
+  }
+
+  static bool box_hit(const flat_bvh_node &node, const point3 &orig,
+                      const real inv_dir[3], interval ray_t) {
+    TRACE_STAT(trace_counters::local().box_tests++);
+    for (int axis = 0; axis < 3; axis++) {
+      auto t0 = (node.bounds_min[axis] - orig[axis]) * inv_dir[axis];
+      auto t1 = (node.bounds_max[axis] - orig[axis]) * inv_dir[axis];
+      if (t0 > t1)
+        std::swap(t0, t1);
+      ray_t.min = t0 > ray_t.min ? t0 : ray_t.min;
+      ray_t.max = t1 < ray_t.max ? t1 : ray_t.max;
+      if (ray_t.max <= ray_t.min)
+        return false;
+    }
+    return true;
+  }
+
+  static float round_down(double v) {
+    float f = float(v);
+    return double(f) > v ? std::nextafter(f, -INFINITY) : f;
+  }
+
+  static float round_up(double v) {
+    float f = float(v);
+    return double(f) < v ? std::nextafter(f, INFINITY) : f;
+  }
+
+  static void set_bounds(flat_bvh_node &node, const aabb &box) {
+    for (int axis = 0; axis < 3; axis++) {
+      node.bounds_min[axis] = round_down(box.axis_interval(axis).min);
+      node.bounds_max[axis] = round_up(box.axis_interval(axis).max);
+    }
+  }
+
+  static int bin_index(double c, const interval &extent) {
+    int b = int(sah_bins * (c - extent.min) / extent.size());
+    return std::clamp(b, 0, sah_bins - 1);
+  }
+
+  // Builds the subtree over items [start, end) and returns its node index.
+  uint32_t build(std::vector<build_item> &items, size_t start, size_t end,
+                 int depth) {
+    uint32_t index = uint32_t(own_nodes.size());
+    own_nodes.emplace_back();
+
+    aabb box, centroid_bounds;
+    for (size_t i = start; i < end; i++) {
+      box = aabb(box, items[i].box);
+      centroid_bounds =
+          aabb(centroid_bounds, aabb(items[i].centroid, items[i].centroid));
+    }
+    set_bounds(own_nodes[index], box);
+
+    size_t count = end - start;
+    size_t mid = start;
+    int axis = centroid_bounds.longest_axis();
+
+    if (count > 1) {
+      if (depth < max_sah_depth)
+        mid = sah_split(items, start, end, box, centroid_bounds, axis);
+      if (mid == start && count > max_leaf_size) {
+        // No SAH split (none found, or we are too deep to keep using SAH) but
+        // the leaf would be too big: split at the median centroid instead.
+        mid = start + count / 2;
+        std::nth_element(items.begin() + start, items.begin() + mid,
+                         items.begin() + end,
+                         [axis](const build_item &a, const build_item &b) {
+                           return a.centroid[axis] < b.centroid[axis];
+                         });
+      }
+    }
+
+    if (mid == start) {
+      own_nodes[index].primitive_count = uint16_t(count);
+      if (triangles) {
+        own_nodes[index].offset = uint32_t(triangles->start_block());
+        for (size_t i = start; i < end; i++)
+          triangles->add_triangle_of(*mesh_source, items[i].index);
+      } else if (soup) {
+        own_nodes[index].offset = uint32_t(soup->start_block());
+        for (size_t i = start; i < end; i++) {
+          if (source) {
+            point3 center;
+            double radius = 0;
+            uint32_t material = 0;
+            source->sphere_at(items[i].index, center, radius, material);
+            soup->add(center, radius, material);
+          } else {
+            size_t lane =
+                soup->add(static_cast<const sphere &>(*owned[items[i].index]));
+            leaf_objects.resize(lane + 1);
+            leaf_objects[lane] = items[i].index;
+          }
+        }
+      } else {
+        own_nodes[index].offset = uint32_t(primitives.size());
+        for (size_t i = start; i < end; i++)
+          primitives.push_back(owned[items[i].index].get());
+      }
+      return index;
+    }
+
+    own_nodes[index].axis = uint8_t(axis);
+    build(items, start, mid, depth + 1);
+    uint32_t second = build(items, mid, end, depth + 1);
+    own_nodes[index].offset = second;
+    return index;
+  }
+
+  // Binned SAH split along the given axis. Returns the split position, or
+  // start when the centroids cannot be separated or a leaf is cheaper.
+  static size_t sah_split(std::vector<build_item> &items, size_t start,
+                          size_t end, const aabb &box,
+                          const aabb &centroid_bounds, int axis) {
+    const interval &extent = centroid_bounds.axis_interval(axis);
+    if (extent.size() <= 0)
+      return start;
+
+    aabb bin_bounds[sah_bins];
+    size_t bin_count[sah_bins] = {};
+    for (size_t i = start; i < end; i++) {
+      int b = bin_index(items[i].centroid[axis], extent);
+      bin_bounds[b] = aabb(bin_bounds[b], items[i].box);
+      bin_count[b]++;
+    }
+
+    double right_area[sah_bins];
+    size_t right_count[sah_bins];
+    aabb acc;
+    size_t count = 0;
+    for (int b = sah_bins - 1; b > 0; b--) {
+      acc = aabb(acc, bin_bounds[b]);
+      count += bin_count[b];
+      right_area[b] = acc.surface_area();
+      right_count[b] = count;
+    }
+
+    int best_split = -1;
+    double best_cost = infinity;
+    acc = aabb();
+    count = 0;
+    for (int b = 0; b < sah_bins - 1; b++) {
+      acc = aabb(acc, bin_bounds[b]);
+      count += bin_count[b];
+      if (count == 0 || right_count[b + 1] == 0)
+        continue;
+      double cost = acc.surface_area() * count +
+                    right_area[b + 1] * right_count[b + 1];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_split = b;
+      }
+    }
+
+    // Relative cost of a leaf versus a split, with one node traversal costing
+    // about as much as one primitive test.
+    double area = box.surface_area();
+    size_t n = end - start;
+    if (best_split < 0 ||
+        (n <= max_leaf_size && area > 0 && 1 + best_cost / area >= double(n)))
+      return start;
+
+    auto mid_it = std::partition(
+        items.begin() + start, items.begin() + end,
+        [&](const build_item &item) {
+          return bin_index(item.centroid[axis], extent) <= best_split;
+        });
+    return size_t(mid_it - items.begin());
+  }
+};
+
+#endif // !FLAT_BVH_H
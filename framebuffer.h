@@ -0,0 +1,24 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "color.h"
+
+#include <vector>
+
+// In-memory image of linear (pre-gamma) pixel colors, filled in by the
+// renderer and written out once the whole image is done (see image_writer.h).
+class framebuffer {
+public:
+  int width = 0;
+  int height = 0;
+  std::vector<color> pixels; // Row-major, top scanline first.
+
+  framebuffer() {}
+  framebuffer(int width, int height)
+      : width(width), height(height), pixels(size_t(width) * height) {}
+
+  color &at(int i, int j) { return pixels[size_t(j) * width + i]; }
+  const color &at(int i, int j) const { return pixels[size_t(j) * width + i]; }
+};
+
+#endif // !FRAMEBUFFER_H
@@ -1,15 +1,25 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include "aabb.h"
+
 class material;
+class material_record;
 
 class hit_record {
 public:
   point3 p;    // Point where ray hits hittable object.
   vec3 normal; // Surface normal from p.
-  shared_ptr<material> mat;
-  double t; // Value of t in equation of incident ray: P(t) = A + t*B where A is
-            // ray origin and B is ray direction.
+  // Not owning: materials are owned by the primitives (or the compiled scene)
+  // that hand them out, which outlive every ray. A raw pointer keeps the hit
+  // path free of shared_ptr reference count updates.
+  const material *mat;
+  // The same material by value, when the primitive keeps a material_record
+  // table (see material.h); null otherwise. Primitives loaded from a scene
+  // cache have no material objects: their mat is null and record is set.
+  const material_record *record = nullptr;
+  real t; // Value of t in equation of incident ray: P(t) = A + t*B where A is
+          // ray origin and B is ray direction.
   bool front_face; // Used to determine whether the incident ray is hitting the
                    // front or back face of the hittable object. This will
                    // inform us of the color to use.
@@ -23,11 +33,54 @@ public:
   }
 };
 
+// A bundle of up to max_size rays traced together, e.g. the primary rays of an
+// 8x8 pixel block. Each ray keeps its own interval and hit record.
+struct ray_packet {
+  static constexpr int max_size = 64;
+
+  int count = 0;
+  ray rays[max_size];
+  interval ray_t[max_size];
+  hit_record rec[max_size];
+  bool hit[max_size];
+};
+
 class hittable {
 public:
   virtual ~hittable() = default;
 
+  // Finds the closest hit within ray_t. rec is only written when the result
+  // is true, which lets callers pass the same record through every object.
   virtual bool hit(const ray &r, interval ray_t, hit_record &rec) const = 0;
+
+  // Whether anything at all is hit within ray_t, e.g. between a point and a
+  // light. Any hit answers that, so overrides stop at the first one they
+  // find and work out no normal, face or material. The default looks for
+  // the closest hit.
+  virtual bool occluded(const ray &r, interval ray_t) const {
+    hit_record rec;
+    return hit(r, ray_t, rec);
+  }
+
+  // occluded() for count rays at once, e.g. the shadow rays of a wavefront:
+  // blocked[k] is set for rays[k] within ray_t[k]. Acceleration structures
+  // override this to make one call instead of one per ray.
+  virtual void occluded_batch(const ray *rays, const interval *ray_t,
+                              size_t count, bool *blocked) const {
+    for (size_t k = 0; k < count; k++)
+      blocked[k] = occluded(rays[k], ray_t[k]);
+  }
+
+  // Finds the closest hit of every ray in the packet. Acceleration structures
+  // override this to share traversal work between coherent rays; the default
+  // just traces the rays one at a time.
+  virtual void hit_packet(ray_packet &packet) const {
+    for (int k = 0; k < packet.count; k++)
+      packet.hit[k] = hit(packet.rays[k], packet.ray_t[k], packet.rec[k]);
+  }
+
+  // Box enclosing the whole object, used to build acceleration structures.
+  virtual aabb bounding_box() const = 0;
 };
 
 #endif // !HITTABLE_H
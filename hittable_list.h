@@ -12,26 +12,44 @@ public:
   hittable_list() {}
   hittable_list(shared_ptr<hittable> object) { add(object); }
 
-  void clear() { objects.clear(); }
+  void clear() {
+    objects.clear();
+    bbox = aabb();
+  }
 
   // IDK why we don't just do push_back in the constructor.
-  void add(shared_ptr<hittable> object) { objects.push_back(object); }
+  void add(shared_ptr<hittable> object) {
+    objects.push_back(object);
+    bbox = aabb(bbox, object->bounding_box());
+  }
 
   bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-    hit_record temp_rec;
     bool hit_anything = false;
     auto closest_so_far = ray_t.max;
 
+    // Objects only write rec when they report a closer hit, so there is no
+    // need for a temporary record copied out on every hit.
     for (const auto &object : objects) {
-      if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+      if (object->hit(r, interval(ray_t.min, closest_so_far), rec)) {
         hit_anything = true;
-        closest_so_far = temp_rec.t;
-        rec = temp_rec;
+        closest_so_far = rec.t;
       }
     }
 
     return hit_anything;
   }
+
+  bool occluded(const ray &r, interval ray_t) const override {
+    for (const auto &object : objects)
+      if (object->occluded(r, ray_t))
+        return true;
+    return false;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+private:
+  aabb bbox;
 };
 
 #endif // !HITTABLE_LIST_H
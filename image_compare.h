@@ -0,0 +1,71 @@
+#ifndef IMAGE_COMPARE_H
+#define IMAGE_COMPARE_H
+
+#include "framebuffer.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Loading rendered images back and measuring how far apart two renders are,
+// for correctness checks against a reference image.
+class image_compare {
+public:
+  // Reads a PFM written by image_writer (little endian, bottom row first).
+  static bool load_pfm(const std::string &path, framebuffer &image) {
+    auto file = mapped_file::open_read(path);
+    if (!file.is_open())
+      return false;
+
+    // The header is three whitespace separated tokens after the magic.
+    std::string head(reinterpret_cast<const char *>(file.data()),
+                     std::min<size_t>(file.size(), 64));
+    int width, height, consumed;
+    float scale;
+    if (std::sscanf(head.c_str(), "PF %d %d %f%n", &width, &height, &scale,
+                    &consumed) != 3 ||
+        width <= 0 || height <= 0 || scale >= 0)
+      return false;
+    size_t offset = size_t(consumed) + 1; // The single newline after it.
+    if (file.size() != offset + 3 * sizeof(float) * width * height)
+      return false;
+
+    image = framebuffer(width, height);
+    const unsigned char *in = file.data() + offset;
+    for (int j = height - 1; j >= 0; j--) {
+      for (int i = 0; i < width; i++) {
+        float rgb[3];
+        std::memcpy(rgb, in, sizeof(rgb));
+        in += sizeof(rgb);
+        image.at(i, j) = color(rgb[0], rgb[1], rgb[2]);
+      }
+    }
+    return true;
+  }
+
+  // Root mean square difference of the displayed (gamma corrected, clamped to
+  // [0,1]) color components, so a stray firefly counts no more than a pixel
+  // that went from black to white. Negative if the sizes differ.
+  static double rmse(const framebuffer &a, const framebuffer &b) {
+    if (a.width != b.width || a.height != b.height || a.pixels.empty())
+      return -1;
+    double sum = 0;
+    for (size_t k = 0; k < a.pixels.size(); k++) {
+      for (int c = 0; c < 3; c++) {
+        double d = display(a.pixels[k][c]) - display(b.pixels[k][c]);
+        sum += d * d;
+      }
+    }
+    return std::sqrt(sum / (3.0 * a.pixels.size()));
+  }
+
+private:
+  static double display(double linear_component) {
+    return std::fmin(linear_to_gamma(linear_component), 1.0);
+  }
+};
+
+#endif // !IMAGE_COMPARE_H
@@ -0,0 +1,396 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "framebuffer.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Image file formats the renderer can write.
+//   ppm_ascii  P3, gamma corrected 8-bit text (the original output format).
+//   ppm        P6, the same pixels as binary bytes, about a third of the size.
+//   pfm        Portable float map of the linear, unclamped colors (HDR).
+//   png        8-bit gamma corrected PNG, compressed by a built-in encoder.
+enum class image_format { ppm_ascii, ppm, pfm, png };
+
+// Minimal zlib stream writer: one deflate block with the fixed Huffman code
+// and greedy LZ77 matching over hash chains. Much simpler than zlib and not
+// as small, but typically a few times smaller than the raw pixels.
+class deflate_writer {
+public:
+  explicit deflate_writer(std::vector<unsigned char> &out) : out(out) {}
+
+  void compress(const std::vector<unsigned char> &data) {
+    out.push_back(0x78); // CMF: deflate, 32K window.
+    out.push_back(0x01); // FLG: fastest compression, valid check bits.
+
+    put_bits(1, 1); // BFINAL
+    put_bits(1, 2); // BTYPE = fixed Huffman
+
+    std::vector<int> head(hash_size, -1);
+    std::vector<int> prev(data.size(), -1);
+    size_t n = data.size();
+    size_t i = 0;
+
+    while (i < n) {
+      int best_len = 0, best_dist = 0;
+      if (i + min_match <= n) {
+        uint32_t h = hash(&data[i]);
+        int candidate = head[h];
+        for (int chain = 0; candidate >= 0 && chain < max_chain; chain++) {
+          size_t dist = i - size_t(candidate);
+          if (dist > window_size)
+            break;
+          size_t limit = std::min(n - i, size_t(max_match));
+          size_t len = 0;
+          while (len < limit && data[candidate + len] == data[i + len])
+            len++;
+          if (int(len) > best_len) {
+            best_len = int(len);
+            best_dist = int(dist);
+            if (len == limit)
+              break;
+          }
+          candidate = prev[candidate];
+        }
+      }
+
+      size_t advance = best_len >= min_match ? size_t(best_len) : 1;
+      for (size_t k = i; k < i + advance && k + min_match <= n; k++) {
+        uint32_t h = hash(&data[k]);
+        prev[k] = head[h];
+        head[h] = int(k);
+      }
+
+      if (best_len >= min_match)
+        put_match(best_len, best_dist);
+      else
+        put_literal(data[i]);
+      i += advance;
+    }
+
+    put_symbol(256); // End of block.
+    flush_bits();
+
+    uint32_t check = adler32(data);
+    for (int shift = 24; shift >= 0; shift -= 8)
+      out.push_back((unsigned char)(check >> shift));
+  }
+
+private:
+  static constexpr int min_match = 3;
+  static constexpr int max_match = 258;
+  static constexpr int max_chain = 32;
+  static constexpr size_t window_size = 32768;
+  static constexpr uint32_t hash_size = 1 << 15;
+
+  std::vector<unsigned char> &out;
+  uint64_t bit_buffer = 0;
+  int bit_count = 0;
+
+  static uint32_t hash(const unsigned char *p) {
+    uint32_t v =
+        uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16);
+    return (v * 2654435761u) >> 17;
+  }
+
+  static uint32_t adler32(const std::vector<unsigned char> &data) {
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < data.size();) {
+      // 5552 is the most bytes that can be summed before b could overflow.
+      size_t end = std::min(data.size(), i + 5552);
+      for (; i < end; i++) {
+        a += data[i];
+        b += a;
+      }
+      a %= 65521;
+      b %= 65521;
+    }
+    return (b << 16) | a;
+  }
+
+  void put_bits(uint32_t value, int count) {
+    bit_buffer |= uint64_t(value) << bit_count;
+    bit_count += count;
+    while (bit_count >= 8) {
+      out.push_back((unsigned char)(bit_buffer & 0xff));
+      bit_buffer >>= 8;
+      bit_count -= 8;
+    }
+  }
+
+  void flush_bits() {
+    if (bit_count > 0)
+      put_bits(0, 8 - bit_count);
+  }
+
+  // Huffman codes are defined most significant bit first, while the rest of
+  // the stream is packed least significant bit first.
+  void put_code(uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int k = 0; k < length; k++)
+      reversed |= ((code >> k) & 1) << (length - 1 - k);
+    put_bits(reversed, length);
+  }
+
+  // The fixed literal/length code from RFC 1951, section 3.2.6.
+  void put_symbol(int symbol) {
+    if (symbol < 144)
+      put_code(0x30 + symbol, 8);
+    else if (symbol < 256)
+      put_code(0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+      put_code(symbol - 256, 7);
+    else
+      put_code(0xc0 + symbol - 280, 8);
+  }
+
+  void put_literal(unsigned char byte) { put_symbol(byte); }
+
+  void put_match(int length, int distance) {
+    static const int length_base[29] = {
+        3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+        31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const int length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                         1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                         4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const int dist_base[30] = {
+        1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+        33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+        1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    static const int dist_extra[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                       4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                       9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    int l = 28;
+    while (length_base[l] > length)
+      l--;
+    put_symbol(257 + l);
+    put_bits(uint32_t(length - length_base[l]), length_extra[l]);
+
+    int d = 29;
+    while (dist_base[d] > distance)
+      d--;
+    put_code(uint32_t(d), 5);
+    put_bits(uint32_t(distance - dist_base[d]), dist_extra[d]);
+  }
+};
+
+// Writes framebuffers to image files. Every format is encoded into one memory
+// buffer and then written with a single call, instead of formatting each pixel
+// through an ostream. When the encoded size is known up front (P6, PFM) and
+// the target is a file, the pixels are encoded straight into a memory mapping
+// of the file instead.
+class image_writer {
+public:
+  // Encodes the whole image into memory.
+  static std::vector<unsigned char> encode(const framebuffer &image,
+                                           image_format format) {
+    std::vector<unsigned char> out;
+    switch (format) {
+    case image_format::ppm_ascii:
+      encode_ppm_ascii(image, out);
+      break;
+    case image_format::ppm:
+      out.resize(encoded_size(image, format));
+      encode_ppm(image, out.data());
+      break;
+    case image_format::pfm:
+      out.resize(encoded_size(image, format));
+      encode_pfm(image, out.data());
+      break;
+    case image_format::png:
+      encode_png(image, out);
+      break;
+    }
+    return out;
+  }
+
+  static bool write(const framebuffer &image, image_format format,
+                    std::ostream &out) {
+    auto bytes = encode(image, format);
+    out.write(reinterpret_cast<const char *>(bytes.data()),
+              std::streamsize(bytes.size()));
+    out.flush();
+    return bool(out);
+  }
+
+  static bool write(const framebuffer &image, image_format format,
+                    const std::string &path) {
+    size_t size = encoded_size(image, format);
+    if (size > 0) {
+      auto file = mapped_file::create(path, size);
+      if (!file.is_open())
+        return false;
+      if (format == image_format::ppm)
+        encode_ppm(image, file.data());
+      else
+        encode_pfm(image, file.data());
+      return file.close();
+    }
+
+    auto bytes = encode(image, format);
+    auto file = mapped_file::create(path, bytes.size());
+    if (!file.is_open())
+      return false;
+    std::memcpy(file.data(), bytes.data(), bytes.size());
+    return file.close();
+  }
+
+private:
+  static std::string header(const framebuffer &image, const char *magic,
+                            const char *max_value) {
+    return std::string(magic) + '\n' + std::to_string(image.width) + ' ' +
+           std::to_string(image.height) + '\n' + max_value + '\n';
+  }
+
+  static size_t encoded_size(const framebuffer &image, image_format format) {
+    size_t pixels = image.pixels.size();
+    if (format == image_format::ppm)
+      return header(image, "P6", "255").size() + 3 * pixels;
+    if (format == image_format::pfm)
+      return header(image, "PF", "-1.0").size() + 3 * sizeof(float) * pixels;
+    return 0; // Not known before encoding.
+  }
+
+  static void encode_ppm(const framebuffer &image, unsigned char *out) {
+    auto head = header(image, "P6", "255");
+    std::memcpy(out, head.data(), head.size());
+    out += head.size();
+    for (const auto &pixel : image.pixels) {
+      *out++ = (unsigned char)(component_to_byte(pixel.x()));
+      *out++ = (unsigned char)(component_to_byte(pixel.y()));
+      *out++ = (unsigned char)(component_to_byte(pixel.z()));
+    }
+  }
+
+  static void encode_pfm(const framebuffer &image, unsigned char *out) {
+    // A negative scale means little endian, and rows go bottom to top. This
+    // assumes a little endian host, as does everything else we run on.
+    auto head = header(image, "PF", "-1.0");
+    std::memcpy(out, head.data(), head.size());
+    out += head.size();
+    for (int j = image.height - 1; j >= 0; j--) {
+      for (int i = 0; i < image.width; i++) {
+        const color &pixel = image.at(i, j);
+        float rgb[3] = {float(pixel.x()), float(pixel.y()), float(pixel.z())};
+        std::memcpy(out, rgb, sizeof(rgb));
+        out += sizeof(rgb);
+      }
+    }
+  }
+
+  static void encode_ppm_ascii(const framebuffer &image,
+                               std::vector<unsigned char> &out) {
+    auto head = header(image, "P3", "255");
+    out.assign(head.begin(), head.end());
+    char line[16];
+    for (const auto &pixel : image.pixels) {
+      int n = std::snprintf(line, sizeof(line), "%d %d %d\n",
+                            component_to_byte(pixel.x()),
+                            component_to_byte(pixel.y()),
+                            component_to_byte(pixel.z()));
+      out.insert(out.end(), line, line + n);
+    }
+  }
+
+  static uint32_t crc32(const unsigned char *data, size_t size,
+                        uint32_t crc = 0) {
+    static const auto table = [] {
+      std::vector<uint32_t> t(256);
+      for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+          c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        t[n] = c;
+      }
+      return t;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+      crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+  }
+
+  static void put_u32(std::vector<unsigned char> &out, uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+      out.push_back((unsigned char)(v >> shift));
+  }
+
+  static void put_chunk(std::vector<unsigned char> &out, const char *type,
+                        const std::vector<unsigned char> &data) {
+    put_u32(out, uint32_t(data.size()));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put_u32(out, crc32(&out[start], out.size() - start));
+  }
+
+  static void encode_png(const framebuffer &image,
+                         std::vector<unsigned char> &out) {
+    static const unsigned char signature[8] = {0x89, 'P',  'N',  'G',
+                                               '\r', '\n', 0x1a, '\n'};
+    out.assign(signature, signature + 8);
+
+    std::vector<unsigned char> ihdr;
+    put_u32(ihdr, uint32_t(image.width));
+    put_u32(ihdr, uint32_t(image.height));
+    ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0}); // 8-bit RGB, no interlace.
+    put_chunk(out, "IHDR", ihdr);
+
+    // Filter every scanline with whichever of None, Sub and Up gives the
+    // smallest sum of absolute (signed) residuals, the usual PNG heuristic.
+    size_t stride = 3 * size_t(image.width);
+    std::vector<unsigned char> row(stride), above(stride, 0);
+    std::vector<unsigned char> raw;
+    raw.reserve((stride + 1) * image.height);
+    std::vector<unsigned char> candidates[3];
+    for (auto &c : candidates)
+      c.resize(stride);
+
+    for (int j = 0; j < image.height; j++) {
+      for (int i = 0; i < image.width; i++) {
+        const color &pixel = image.at(i, j);
+        row[3 * i + 0] = (unsigned char)(component_to_byte(pixel.x()));
+        row[3 * i + 1] = (unsigned char)(component_to_byte(pixel.y()));
+        row[3 * i + 2] = (unsigned char)(component_to_byte(pixel.z()));
+      }
+
+      long best_cost = -1;
+      int best = 0;
+      for (int filter = 0; filter < 3; filter++) {
+        long cost = 0;
+        for (size_t k = 0; k < stride; k++) {
+          unsigned char predictor = filter == 1 ? (k >= 3 ? row[k - 3] : 0)
+                                    : filter == 2 ? above[k]
+                                                  : 0;
+          unsigned char residual = (unsigned char)(row[k] - predictor);
+          candidates[filter][k] = residual;
+          cost += residual < 128 ? residual : 256 - residual;
+        }
+        if (best_cost < 0 || cost < best_cost) {
+          best_cost = cost;
+          best = filter;
+        }
+      }
+
+      raw.push_back((unsigned char)best);
+      raw.insert(raw.end(), candidates[best].begin(), candidates[best].end());
+      std::swap(row, above);
+    }
+
+    std::vector<unsigned char> idat;
+    deflate_writer(idat).compress(raw);
+    put_chunk(out, "IDAT", idat);
+    put_chunk(out, "IEND", {});
+  }
+};
+
+#endif // !IMAGE_WRITER_H
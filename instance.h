@@ -0,0 +1,62 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+#include "transform.h"
+
+#include <utility>
+
+// An object placed in the scene by an affine transform, such as one of many
+// copies of a cluster of spheres. The object, typically a flat_bvh over the
+// cluster, is shared by every instance of it and is the bottom level of a
+// two-level structure: the instances go into a flat_bvh of their own, the
+// top level, whose leaves hand rays down to the shared trees. Memory then
+// grows with the distinct geometry plus one small record per instance,
+// rather than with every copied primitive.
+//
+// Rays are moved into object space, not the object into world space. The
+// direction is not renormalized there, so t is the same in both spaces and
+// the object's hit distance is the world's. Only the world to object
+// transform is kept: the hit point is taken on the world ray, and normals go
+// back through its transpose.
+class instance : public hittable {
+public:
+  instance(shared_ptr<hittable> object, const affine_transform &to_world)
+      : object(std::move(object)) {
+    set_transform(to_world);
+  }
+
+  // Moves the instance. Trees built over it see the change after a
+  // flat_bvh::refit().
+  void set_transform(const affine_transform &to_world) {
+    to_object = to_world.inverse();
+    bbox = to_world.apply_box(object->bounding_box());
+  }
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    ray local(to_object.apply_point(r.origin()),
+              to_object.apply_vector(r.direction()));
+    if (!object->hit(local, ray_t, rec))
+      return false;
+    // The transform keeps the sign of dot(direction, normal), so front_face
+    // and the normal's side carry over unchanged.
+    rec.p = r.at(rec.t);
+    rec.normal = unit_vector(to_object.apply_transposed(rec.normal));
+    return true;
+  }
+
+  bool occluded(const ray &r, interval ray_t) const override {
+    return object->occluded(ray(to_object.apply_point(r.origin()),
+                                to_object.apply_vector(r.direction())),
+                            ray_t);
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+private:
+  shared_ptr<hittable> object;
+  affine_transform to_object;
+  aabb bbox; // In world space.
+};
+
+#endif // !INSTANCE_H
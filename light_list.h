@@ -0,0 +1,141 @@
+#ifndef LIGHT_LIST_H
+#define LIGHT_LIST_H
+
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "sphere_soup.h"
+#include "warp.h"
+
+#include <cmath>
+#include <typeinfo>
+#include <vector>
+
+// The sphere lights of a scene (spheres of diffuse_light), for sampling
+// light directly rather than waiting for paths to run into it. A light is
+// picked uniformly, then a direction towards it uniformly from the cone the
+// sphere fills as seen from the shading point (Shirley, Wang and Zimmerman,
+// "Monte Carlo Techniques for Direct Lighting Calculations", 1996). Every
+// such direction hits the light, so even a small, distant light is found
+// with every sample, where uniform points on its surface would waste half
+// on the side facing away.
+//
+// Lights taken from spheres are read through them, so they follow spheres
+// moved by an animation. Emitting surfaces the list does not hold, such as
+// lights inside instances, still light the scene when paths hit them.
+class light_list {
+public:
+  light_list() {}
+
+  // The light spheres among the objects of world (not those inside nested
+  // objects such as trees or instances).
+  explicit light_list(const hittable_list &world) {
+    for (const auto &object : world.objects) {
+      auto *s = dynamic_cast<const sphere *>(object.get());
+      if (!s)
+        continue;
+      // Exactly diffuse_light: a subclass may emit something else.
+      const material *mat = s->mat().get();
+      if (typeid(*mat) == typeid(diffuse_light)) {
+        auto *emit = static_cast<const diffuse_light *>(mat);
+        lights.push_back({s, s->center(), s->radius(), emit->emission()});
+      }
+    }
+  }
+
+  // The light spheres of a soup, e.g. one mapped from a scene cache.
+  explicit light_list(const sphere_soup &soup) {
+    auto arrays = soup.data();
+    for (size_t i = 0; i < arrays.count; i++) {
+      point3 center;
+      double radius;
+      uint32_t material;
+      if (!soup.sphere_at(i, center, radius, material))
+        continue;
+      const material_record &record = arrays.records[material];
+      if (record.type() == material_record::kind::light)
+        lights.push_back({nullptr, center, real(radius), record.albedo});
+    }
+  }
+
+  size_t size() const { return lights.size(); }
+  bool empty() const { return lights.empty(); }
+
+  // A direction from a point towards a light.
+  struct light_sample {
+    vec3 direction;  // Unit length.
+    double distance; // To the light's surface along direction.
+    color radiance;  // What the light gives off.
+    double pdf;      // Density over solid angle, light choice included.
+  };
+
+  // Picks a light with u_light and a direction from p towards it with the
+  // pair u, all uniform in [0, 1). False when p is inside the light picked.
+  bool sample(const point3 &p, double u_light, const vec3 &u,
+              light_sample &out) const {
+    size_t k = std::min(size_t(u_light * double(lights.size())),
+                        lights.size() - 1);
+    const light &l = lights[k];
+    vec3 to_center = center(l) - p;
+    double d2 = to_center.length_squared();
+    double r2 = double(l.radius) * l.radius;
+    if (d2 <= r2)
+      return false;
+    double one_minus_cos = cone_height(r2, d2);
+    double d = std::sqrt(d2);
+    out.direction = uniform_cone(to_center / d, real(one_minus_cos),
+                                 real(u.x()), real(u.y()));
+    // The near root of the ray against the sphere.
+    double along = dot(out.direction, to_center);
+    out.distance = along - std::sqrt(std::fmax(0, r2 - (d2 - along * along)));
+    out.radiance = l.emit;
+    out.pdf = 1 / (2 * pi * one_minus_cos * double(lights.size()));
+    return true;
+  }
+
+  // The density with which sample() picks the direction from `from` to
+  // `on`, a point on one of the lights. 0 if `on` is on none of them.
+  double pdf(const point3 &from, const point3 &on) const {
+    // The light whose surface is nearest to the point.
+    const light *found = nullptr;
+    double nearest = infinity;
+    for (const auto &l : lights) {
+      double gap = std::fabs((on - center(l)).length() - l.radius);
+      if (gap < nearest) {
+        nearest = gap;
+        found = &l;
+      }
+    }
+    if (!found || nearest > 1e-4 * (1 + found->radius))
+      return 0;
+    double d2 = (center(*found) - from).length_squared();
+    double r2 = double(found->radius) * found->radius;
+    if (d2 <= r2)
+      return 0;
+    return 1 / (2 * pi * cone_height(r2, d2) * double(lights.size()));
+  }
+
+private:
+  struct light {
+    const sphere *source; // Read for the center when set.
+    point3 center;
+    real radius;
+    color emit;
+  };
+
+  std::vector<light> lights;
+
+  static point3 center(const light &l) {
+    return l.source ? l.source->center() : l.center;
+  }
+
+  // 1 - cos(theta_max) of the cone a sphere of squared radius r2 fills at
+  // squared distance d2, as (r2 / d2) / (1 + cos(theta_max)), which keeps
+  // its digits for small, distant lights.
+  static double cone_height(double r2, double d2) {
+    double sin2 = r2 / d2;
+    return sin2 / (1 + std::sqrt(1 - sin2));
+  }
+};
+
+#endif // !LIGHT_LIST_H
@@ -1,70 +1,118 @@
 #include "rtweekend.h"
 
+#include "animation.h"
+#include "arena.h"
 #include "camera.h"
+#include "flat_bvh.h"
 #include "hittable.h"
 #include "hittable_list.h"
-#include "material.h"
-#include "sphere.h"
-
-int main() {
-
-  // World
-  hittable_list world;
-
-  auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-  world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
-
-  for (int a = -11; a < 11; a++) {
-    for (int b = -11; b < 11; b++) {
-      auto choose_mat = random_double();
-      point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-      if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-        shared_ptr<material> sphere_material;
-
-        if (choose_mat < 0.8) {
-          // diffuse
-          auto albedo = color::random() * color::random();
-          sphere_material = make_shared<lambertian>(albedo);
-          world.add(make_shared<sphere>(center, 0.2, sphere_material));
-        } else if (choose_mat < 0.95) {
-          // metal
-          auto albedo = color::random(0.5, 1);
-          auto fuzz = random_double(0, 0.5);
-          sphere_material = make_shared<metal>(albedo, fuzz);
-          world.add(make_shared<sphere>(center, 0.2, sphere_material));
-        } else {
-          // glass
-          sphere_material = make_shared<dielectric>(1.5);
-          world.add(make_shared<sphere>(center, 0.2, sphere_material));
-        }
-      }
+#include "light_list.h"
+#include "scene_cache.h"
+#include "scene_file.h"
+#include "scenes.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+// Renders the book's final scene, or the scene file or scene cache given as
+// the first argument:
+//
+//   rtweekend [scene] > image.ppm
+//   rtweekend [scene] --write-scene out.txt
+//   rtweekend [scene] --write-cache out.cache [--no-bvh]
+//   rtweekend [scene] --frames 48 [--frame-pattern frame_####.ppm]
+//
+// The --write options convert the scene instead of rendering it. --frames
+// renders an animation with one scene, one tree and one thread pool: the
+// scene file's camera and sphere keys (see scene_file.h), or a turntable
+// around the view when it has none.
+int main(int argc, char **argv) {
+  auto setup_start = std::chrono::steady_clock::now();
+  std::string scene_path, text_out, cache_out;
+  std::string frame_pattern = "frame_####.ppm";
+  bool cache_bvh = true;
+  int frames = 0;
+  for (int k = 1; k < argc; k++) {
+    bool has_value = k + 1 < argc;
+    if (!std::strcmp(argv[k], "--write-scene") && has_value)
+      text_out = argv[++k];
+    else if (!std::strcmp(argv[k], "--write-cache") && has_value)
+      cache_out = argv[++k];
+    else if (!std::strcmp(argv[k], "--no-bvh"))
+      cache_bvh = false;
+    else if (!std::strcmp(argv[k], "--frames") && has_value &&
+             (frames = std::atoi(argv[k + 1])) > 0)
+      k++;
+    else if (!std::strcmp(argv[k], "--frame-pattern") && has_value)
+      frame_pattern = argv[++k];
+    else if (argv[k][0] != '-' && scene_path.empty())
+      scene_path = argv[k];
+    else {
+      std::clog << "usage: " << argv[0]
+                << " [scene] [--write-scene out.txt]"
+                   " [--write-cache out.cache [--no-bvh]]"
+                   " [--frames n [--frame-pattern frame_####.ppm]]\n";
+      return 2;
     }
   }
 
-  auto material1 = make_shared<dielectric>(1.5);
-  world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-  auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-  world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-  auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-  world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
   camera cam;
+  book_final_view(cam);
 
-  cam.aspect_ratio = 16.0 / 9.0;
   cam.image_width = 1200;
   cam.samples_per_pixel = 100;
   cam.max_depth = 50;
-
-  cam.vfov = 20;
-  cam.lookfrom = point3(13, 2, 3);
-  cam.lookat = point3(0, 0, 0);
-  cam.vup = vec3(0, 1, 0);
-
-  cam.defocus_angle = 0.6;
-  cam.focus_dist = 10.0;
+  cam.num_threads = 0;
+  cam.sampling = sampler_type::sobol;
+  cam.packet_primary = true;
+  cam.russian_roulette = true;
+
+  // World. Every primitive and material lives in one arena, freed in bulk.
+  // Scene files override the camera settings above.
+  arena scene_arena;
+  hittable_list world;
+  animation anim;
+  std::unique_ptr<flat_bvh> built;
+  scene_cache cache;
+  std::string error;
+  bool from_cache = !scene_path.empty() && scene_cache::is_cache(scene_path);
+  if (from_cache) {
+    if (!cache.open(scene_path, cam, error)) {
+      std::clog << error << '\n';
+      return 1;
+    }
+  } else {
+    if (scene_path.empty())
+      world = book_final_scene(scene_arena);
+    else if (!scene_file::load(scene_path, scene_arena, world, cam, anim,
+                               error)) {
+      std::clog << error << '\n';
+      return 1;
+    }
+    built = std::make_unique<flat_bvh>(world);
+  }
+  flat_bvh &scene = from_cache ? cache.tree() : *built;
+  light_list lights;
+  if (!from_cache)
+    lights = light_list(world);
+  else if (scene.sphere_leaves())
+    lights = light_list(*scene.sphere_leaves());
+
+  if (!text_out.empty() || !cache_out.empty()) {
+    if (!text_out.empty() &&
+        (from_cache || !scene_file::save(text_out, world, cam))) {
+      std::clog << "Cannot write " << text_out << '\n';
+      return 1;
+    }
+    if (!cache_out.empty() &&
+        (from_cache || !scene_cache::save(cache_out, *built, cam, cache_bvh))) {
+      std::clog << "Cannot write " << cache_out << '\n';
+      return 1;
+    }
+    return 0;
+  }
 
   // auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
   // auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
@@ -108,5 +156,16 @@ int main() {
   // cam.defocus_angle = 10.0;
   // cam.focus_dist = 3.4;
 
-  cam.render(world);
+  if (frames > 0) {
+    if (!anim.has_camera_path() && !anim.moves_spheres())
+      anim = animation::turntable(cam, frames);
+    std::chrono::duration<double> setup =
+        std::chrono::steady_clock::now() - setup_start;
+    return render_animation(anim, frames, cam, scene, lights, frame_pattern,
+                            setup.count())
+               ? 0
+               : 1;
+  }
+
+  cam.render(scene, lights);
 }
@@ -0,0 +1,148 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_MMAP 1
+#endif
+
+// A whole file mapped into memory, either read-only or freshly created with a
+// fixed size for writing. Where mmap is not available the file is read into
+// (or, on close, written out from) a heap buffer instead, behind the same
+// interface.
+class mapped_file {
+public:
+  mapped_file() {}
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+  mapped_file(mapped_file &&other) { *this = std::move(other); }
+  mapped_file &operator=(mapped_file &&other) {
+    if (this != &other) {
+      close();
+      std::swap(path, other.path);
+      std::swap(bytes, other.bytes);
+      std::swap(length, other.length);
+      std::swap(writable, other.writable);
+      std::swap(fd, other.fd);
+      std::swap(fallback, other.fallback);
+    }
+    return *this;
+  }
+  ~mapped_file() { close(); }
+
+  // Creates (or truncates) path with the given size, mapped for writing.
+  static mapped_file create(const std::string &path, size_t size) {
+    mapped_file file;
+    file.path = path;
+    file.length = size;
+    file.writable = true;
+#ifdef MAPPED_FILE_MMAP
+    file.fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file.fd < 0 || ::ftruncate(file.fd, off_t(size)) != 0)
+      return failed(file);
+    if (size > 0) {
+      void *map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         file.fd, 0);
+      if (map == MAP_FAILED)
+        return failed(file);
+      file.bytes = static_cast<unsigned char *>(map);
+    }
+#else
+    file.fallback.resize(size);
+    file.bytes = file.fallback.data();
+    file.fd = 0;
+#endif
+    return file;
+  }
+
+  // Maps an existing file read-only. is_open() is false if that fails.
+  static mapped_file open_read(const std::string &path) {
+    mapped_file file;
+    file.path = path;
+#ifdef MAPPED_FILE_MMAP
+    file.fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (file.fd < 0 || ::fstat(file.fd, &info) != 0)
+      return failed(file);
+    file.length = size_t(info.st_size);
+    if (file.length > 0) {
+      void *map =
+          ::mmap(nullptr, file.length, PROT_READ, MAP_PRIVATE, file.fd, 0);
+      if (map == MAP_FAILED)
+        return failed(file);
+      file.bytes = static_cast<unsigned char *>(map);
+    }
+#else
+    std::FILE *in = std::fopen(path.c_str(), "rb");
+    if (!in)
+      return file;
+    unsigned char buffer[65536];
+    size_t n;
+    while ((n = std::fread(buffer, 1, sizeof(buffer), in)) > 0)
+      file.fallback.insert(file.fallback.end(), buffer, buffer + n);
+    std::fclose(in);
+    file.length = file.fallback.size();
+    file.bytes = file.fallback.data();
+    file.fd = 0;
+#endif
+    return file;
+  }
+
+  bool is_open() const { return fd >= 0; }
+  unsigned char *data() { return bytes; }
+  const unsigned char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+  // Unmaps and closes the file. Returns false if anything failed, which for
+  // a written file means its contents may be incomplete.
+  bool close() {
+    if (fd < 0)
+      return false;
+    bool ok = true;
+#ifdef MAPPED_FILE_MMAP
+    if (bytes)
+      ok = ::munmap(bytes, length) == 0;
+    ok = (::close(fd) == 0) && ok;
+#else
+    if (writable) {
+      std::FILE *out = std::fopen(path.c_str(), "wb");
+      ok = out && std::fwrite(bytes, 1, length, out) == length;
+      ok = out && (std::fclose(out) == 0) && ok;
+    }
+    fallback.clear();
+#endif
+    bytes = nullptr;
+    length = 0;
+    fd = -1;
+    return ok;
+  }
+
+private:
+  std::string path;
+  unsigned char *bytes = nullptr;
+  size_t length = 0;
+  bool writable = false;
+  int fd = -1;
+  std::vector<unsigned char> fallback;
+
+  static mapped_file failed(mapped_file &file) {
+#ifdef MAPPED_FILE_MMAP
+    if (file.fd >= 0)
+      ::close(file.fd);
+#endif
+    file.fd = -1;
+    file.bytes = nullptr;
+    file.length = 0;
+    return std::move(file);
+  }
+};
+
+#endif // !MAPPED_FILE_H
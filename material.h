@@ -2,8 +2,13 @@
 #define MATERIAL_H
 
 #include "hittable.h"
+#include "sampler.h"
+#include "trace_stats.h"
 #include "vec3.h"
 
+#include <cstdint>
+#include <typeinfo>
+
 class material {
 public:
   virtual ~material() = default;
@@ -12,26 +17,60 @@ public:
                        color &attenuation, ray &scattered) const {
     return false;
   }
+
+  // Radiance the surface gives off at the hit, towards the ray that hit it.
+  virtual color emitted(const hit_record &rec) const { return color(0, 0, 0); }
+
+  // The density (per solid angle) with which scatter() picks direction, for
+  // materials that can be lit by sampling the lights: their attenuation must
+  // not depend on the direction picked, so that attenuation * pdf is the
+  // BSDF times the cosine. 0 for materials that scatter into a few exact
+  // directions (mirrors, glass) or whose density is not known.
+  virtual double scattering_pdf(const hit_record &rec,
+                                const vec3 &direction) const {
+    return 0;
+  }
 };
 
+// The built-in materials below keep their scatter math in static
+// scatter_with() functions, shared by the virtual scatter() and by
+// material_record, so both dispatch paths draw the same random numbers and
+// produce the same image. Those take their uniform sample values as
+// arguments, which both paths draw from the pixel sample's sampler (see
+// sample_2d() in sampler.h), so the bounces get stratified values too.
+
 class lambertian : public material {
 public:
   lambertian(const color &albedo) : albedo(albedo) {}
 
   bool scatter(const ray &r_in, const hit_record &rec, color &attenuation,
                ray &scattered) const override {
-    auto scatter_direction = rec.normal + random_unit_vector();
-
-    if (scatter_direction.near_zero()) {
-      scatter_direction = rec.normal;
-    }
+    return scatter_with(albedo, rec, sample_2d(), attenuation, scattered);
+  }
 
-    scattered = ray(rec.p, scatter_direction);
+  static bool scatter_with(const color &albedo, const hit_record &rec,
+                           const vec3 &u, color &attenuation, ray &scattered) {
+    // Cosine-weighted about the normal, the distribution the book gets from
+    // normal + random_unit_vector(), but mapped directly (see warp.h) and
+    // never degenerate.
+    scattered =
+        ray(rec.p, cosine_hemisphere(rec.normal, real(u.x()), real(u.y())));
     attenuation = albedo;
     return true;
   }
 
+  double scattering_pdf(const hit_record &rec,
+                        const vec3 &direction) const override {
+    return pdf_with(rec, direction);
+  }
+
+  static double pdf_with(const hit_record &rec, const vec3 &direction) {
+    auto cosine = dot(rec.normal, unit_vector(direction));
+    return cosine > 0 ? cosine / pi : 0;
+  }
+
 private:
+  friend class material_record;
   color albedo;
 };
 
@@ -42,15 +81,24 @@ public:
 
   bool scatter(const ray &r_in, const hit_record &rec, color &attenuation,
                ray &scattered) const override {
+    return scatter_with(albedo, fuzz, r_in, rec, sample_2d(), attenuation,
+                        scattered);
+  }
+
+  static bool scatter_with(const color &albedo, double fuzz, const ray &r_in,
+                           const hit_record &rec, const vec3 &u,
+                           color &attenuation, ray &scattered) {
     vec3 reflected_direction = reflect(r_in.direction(), rec.normal);
     vec3 fuzzed_direction =
-        unit_vector(reflected_direction) + (fuzz * random_unit_vector());
+        unit_vector(reflected_direction) +
+        (fuzz * uniform_sphere(real(u.x()), real(u.y())));
     scattered = ray(rec.p, fuzzed_direction);
     attenuation = albedo;
     return (dot(scattered.direction(), rec.normal) > 0);
   }
 
 private:
+  friend class material_record;
   color albedo;
   double fuzz;
 };
@@ -61,6 +109,14 @@ public:
 
   bool scatter(const ray &r_in, const hit_record &rec, color &attenuation,
                ray &scattered) const override {
+    return scatter_with(refraction_index, r_in, rec, sample_1d(), attenuation,
+                        scattered);
+  }
+
+  // u picks between reflection and refraction.
+  static bool scatter_with(double refraction_index, const ray &r_in,
+                           const hit_record &rec, double u,
+                           color &attenuation, ray &scattered) {
     // No attenuation since the dielectric is clear. Later we can add this as a
     // tint.
     attenuation = color(1.0, 1.0, 1.0);
@@ -72,7 +128,7 @@ public:
     bool cannot_refract = ri * sin_theta > 1.0;
     vec3 direction;
 
-    if (cannot_refract || reflectance(cos_theta, ri) > random_double()) {
+    if (cannot_refract || reflectance(cos_theta, ri) > u) {
       // Can't refract, will reflect
       direction = reflect(unit_direction, rec.normal);
     } else {
@@ -84,6 +140,7 @@ public:
   }
 
 private:
+  friend class material_record;
   double refraction_index;
 
   static double reflectance(double cosine, double refraction_index) {
@@ -93,4 +150,187 @@ private:
     return r0 + (1 - r0) * std::pow((1 - cosine), 5);
   }
 };
+
+// A surface that gives off light of one color and reflects none, seen from
+// the outside (the front face) only. Spheres made of it are the lights a
+// light_list samples.
+class diffuse_light : public material {
+public:
+  diffuse_light(const color &emit) : emit(emit) {}
+
+  color emitted(const hit_record &rec) const override {
+    return emitted_with(emit, rec);
+  }
+
+  static color emitted_with(const color &emit, const hit_record &rec) {
+    return rec.front_face ? emit : color(0, 0, 0);
+  }
+
+  const color &emission() const { return emit; }
+
+private:
+  friend class material_record;
+  color emit;
+};
+
+// A material by value: a type tag and the parameters of one of the built-in
+// materials, dispatched with a switch instead of a virtual call, so the
+// compiler can inline scatter into the bounce loop. Compiled scenes keep a
+// table of these next to their primitives (see sphere_soup.h) and point
+// hit_record::record at an entry. Materials outside the built-in set, e.g.
+// user extensions, become `other` records that forward to the virtual call.
+// So do subclasses of the built-in materials, which may override scatter().
+class material_record {
+public:
+  enum class kind : uint8_t { lambertian, metal, dielectric, light, other };
+
+  material_record() {}
+
+  // The kind of a material: a built-in one only for exactly that type.
+  // `other` for no material at all, e.g. a mesh not given one yet.
+  static kind kind_of(const material *mat) {
+    if (!mat)
+      return kind::other;
+    const std::type_info &type = typeid(*mat);
+    if (type == typeid(lambertian))
+      return kind::lambertian;
+    if (type == typeid(metal))
+      return kind::metal;
+    if (type == typeid(dielectric))
+      return kind::dielectric;
+    if (type == typeid(diffuse_light))
+      return kind::light;
+    return kind::other;
+  }
+
+  static material_record from(const material *mat) {
+    material_record r;
+    r.mat = mat;
+    r.tag = kind_of(mat);
+    switch (r.tag) {
+    case kind::lambertian:
+      r.albedo = static_cast<const lambertian *>(mat)->albedo;
+      break;
+    case kind::metal:
+      r.albedo = static_cast<const metal *>(mat)->albedo;
+      r.param = static_cast<const metal *>(mat)->fuzz;
+      break;
+    case kind::dielectric:
+      r.param = static_cast<const dielectric *>(mat)->refraction_index;
+      break;
+    case kind::light:
+      r.albedo = static_cast<const diffuse_light *>(mat)->emit;
+      break;
+    case kind::other:
+      break;
+    }
+    return r;
+  }
+
+  kind type() const { return tag; }
+
+  // The material this record was made from, or null for records loaded from
+  // a scene cache, which are always of a built-in kind.
+  const material *source() const { return mat; }
+
+  // The dynamic type of the material the record stands for, or void for a
+  // record made without one.
+  const std::type_info &material_type() const {
+    switch (tag) {
+    case kind::lambertian:
+      return typeid(lambertian);
+    case kind::metal:
+      return typeid(metal);
+    case kind::dielectric:
+      return typeid(dielectric);
+    case kind::light:
+      return typeid(diffuse_light);
+    case kind::other:
+      break;
+    }
+    return mat ? typeid(*mat) : typeid(void);
+  }
+
+  bool scatter(const ray &r_in, const hit_record &rec, color &attenuation,
+               ray &scattered) const {
+    switch (tag) {
+    case kind::lambertian:
+      return lambertian::scatter_with(albedo, rec, sample_2d(), attenuation,
+                                      scattered);
+    case kind::metal:
+      return metal::scatter_with(albedo, param, r_in, rec, sample_2d(),
+                                 attenuation, scattered);
+    case kind::dielectric:
+      return dielectric::scatter_with(param, r_in, rec, sample_1d(),
+                                      attenuation, scattered);
+    case kind::light:
+      return false;
+    case kind::other:
+      break;
+    }
+    return mat->scatter(r_in, rec, attenuation, scattered);
+  }
+
+  color emitted(const hit_record &rec) const {
+    switch (tag) {
+    case kind::lambertian:
+    case kind::metal:
+    case kind::dielectric:
+      return color(0, 0, 0);
+    case kind::light:
+      return diffuse_light::emitted_with(albedo, rec);
+    case kind::other:
+      break;
+    }
+    return mat->emitted(rec);
+  }
+
+  double scattering_pdf(const hit_record &rec, const vec3 &direction) const {
+    switch (tag) {
+    case kind::lambertian:
+      return lambertian::pdf_with(rec, direction);
+    case kind::metal:
+    case kind::dielectric:
+    case kind::light:
+      return 0;
+    case kind::other:
+      break;
+    }
+    return mat->scattering_pdf(rec, direction);
+  }
+
+private:
+  friend class scene_file;
+  friend class scene_cache;
+  friend class light_list;
+  color albedo; // Or the emitted color of a light.
+  double param = 0; // fuzz (metal) or refraction index (dielectric)
+  const material *mat = nullptr; // The material this record was made from.
+  kind tag = kind::other;
+};
+
+// Scatters off whatever the hit record carries: the material record when the
+// primitive has one, the virtual material otherwise.
+inline bool scatter(const ray &r_in, const hit_record &rec, color &attenuation,
+                    ray &scattered) {
+  TRACE_STAT({
+    auto type = rec.record ? rec.record->type()
+                           : material_record::kind_of(rec.mat);
+    trace_counters::local().material_hits[int(type)]++;
+  });
+  if (rec.record)
+    return rec.record->scatter(r_in, rec, attenuation, scattered);
+  return rec.mat->scatter(r_in, rec, attenuation, scattered);
+}
+
+// Likewise for emitted() and scattering_pdf().
+inline color emitted(const hit_record &rec) {
+  return rec.record ? rec.record->emitted(rec) : rec.mat->emitted(rec);
+}
+
+inline double scattering_pdf(const hit_record &rec, const vec3 &direction) {
+  return rec.record ? rec.record->scattering_pdf(rec, direction)
+                    : rec.mat->scattering_pdf(rec, direction);
+}
+
 #endif // MATERIAL_H
@@ -0,0 +1,296 @@
+#ifndef OBJ_FILE_H
+#define OBJ_FILE_H
+
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Wavefront OBJ meshes. Reads `v` and `vn` lines and `f` lines of any of the
+// forms `f 1 2 3`, `f 1/1 2/2 3/3`, `f 1//1 2//2 3//3` or `f 1/1/1 ...`,
+// with negative (relative) indices allowed. Faces with more than three
+// corners are split into a fan. Texture coordinates, groups, smoothing and
+// material statements are skipped, since a mesh has one material.
+//
+// The file is memory mapped and cut into chunks at line breaks, which are
+// parsed in parallel straight from the mapping, without copying lines into
+// strings. Each chunk collects its own vertices and faces; indices that are
+// relative, or that point before the chunk, are resolved once the vertex
+// counts of all earlier chunks are known, and the chunks are then appended
+// to the mesh in file order.
+class obj_file {
+public:
+  // Appends the mesh at path to mesh, keeping its material. threads is the
+  // number of parser threads, 0 for one per hardware thread. On failure
+  // error holds "path:line: message" (or "path: message") and mesh may hold
+  // part of the file.
+  static bool load(const std::string &path, triangle_mesh &mesh,
+                   std::string &error, int threads = 0) {
+    auto file = mapped_file::open_read(path);
+    if (!file.is_open()) {
+      error = path + ": cannot open";
+      return false;
+    }
+    auto text = reinterpret_cast<const char *>(file.data());
+    return parse(text, text + file.size(), path, mesh, error, threads);
+  }
+
+  static bool parse(const char *text, const char *text_end,
+                    const std::string &name, triangle_mesh &mesh,
+                    std::string &error, int threads = 0) {
+    if (threads < 1)
+      threads = thread_pool::default_thread_count();
+    size_t size = size_t(text_end - text);
+    size_t count = std::max<size_t>(
+        1, std::min<size_t>(4 * size_t(threads), size / min_chunk_bytes));
+
+    std::vector<chunk> chunks(count);
+    const char *start = text;
+    for (size_t k = 0; k < count; k++) {
+      const char *stop = text + size * (k + 1) / count;
+      stop = std::max(stop, start);
+      while (stop > text && stop < text_end && stop[-1] != '\n')
+        stop++;
+      chunks[k].begin = start;
+      chunks[k].end = stop;
+      start = stop;
+    }
+
+    if (threads == 1 || count == 1) {
+      for (auto &c : chunks)
+        parse_chunk(c);
+    } else {
+      thread_pool pool(threads);
+      for (auto &c : chunks)
+        pool.submit([&c] { parse_chunk(c); });
+      pool.wait();
+    }
+
+    size_t lines = 0;
+    for (const auto &c : chunks) {
+      if (!c.error.empty()) {
+        error = name + ":" + std::to_string(lines + c.error_line) + ": " +
+                c.error;
+        return false;
+      }
+      lines += c.lines;
+    }
+
+    // Vertices and normals of the file go after those already in the mesh.
+    mesh_buffers &buffers = mesh.vertex_data();
+    int64_t vertex_base = int64_t(buffers.x.size());
+    int64_t normal_base = int64_t(buffers.nx.size());
+    int64_t vertices = vertex_base, normals = normal_base;
+    size_t triangles = mesh.size();
+    for (auto &c : chunks) {
+      c.vertex_base = vertices;
+      c.normal_base = normals;
+      vertices += int64_t(c.x.size());
+      normals += int64_t(c.nx.size());
+      triangles += c.corners.size() / 3;
+    }
+    if (vertices > int64_t(triangle_mesh::no_normal)) {
+      error = name + ": too many vertices";
+      return false;
+    }
+    for (auto *array : {&buffers.x, &buffers.y, &buffers.z})
+      array->reserve(size_t(vertices));
+    for (auto *array : {&buffers.nx, &buffers.ny, &buffers.nz})
+      array->reserve(size_t(normals));
+    for (const auto &c : chunks) {
+      append(buffers.x, c.x);
+      append(buffers.y, c.y);
+      append(buffers.z, c.z);
+      append(buffers.nx, c.nx);
+      append(buffers.ny, c.ny);
+      append(buffers.nz, c.nz);
+    }
+
+    mesh.reserve(triangles);
+    for (const auto &c : chunks) {
+      for (size_t k = 0; k < c.corners.size(); k += 3) {
+        uint32_t v[3], n[3];
+        for (int i = 0; i < 3; i++) {
+          const corner &at = c.corners[k + i];
+          int64_t vi = resolve(at.vertex, at.relative_vertex, vertex_base,
+                               c.vertex_base);
+          if (vi < vertex_base || vi >= vertices) {
+            error = name + ": a face refers to a missing vertex";
+            return false;
+          }
+          v[i] = uint32_t(vi);
+          n[i] = triangle_mesh::no_normal;
+          if (at.has_normal) {
+            int64_t ni = resolve(at.normal, at.relative_normal, normal_base,
+                                 c.normal_base);
+            if (ni < normal_base || ni >= normals) {
+              error = name + ": a face refers to a missing normal";
+              return false;
+            }
+            n[i] = uint32_t(ni);
+          }
+        }
+        // Normals are interpolated only when every corner has one.
+        if (n[0] == triangle_mesh::no_normal ||
+            n[1] == triangle_mesh::no_normal ||
+            n[2] == triangle_mesh::no_normal)
+          n[0] = n[1] = n[2] = triangle_mesh::no_normal;
+        mesh.add_triangle(v[0], v[1], v[2], n[0], n[1], n[2]);
+      }
+    }
+    return true;
+  }
+
+private:
+  // Below this a chunk is not worth a thread.
+  static constexpr size_t min_chunk_bytes = 1 << 20;
+
+  // One corner of a face. Absolute indices count from the first vertex of
+  // the file; relative ones from the end of the chunk's vertices so far,
+  // which only becomes a file index once the earlier chunks are counted.
+  struct corner {
+    int64_t vertex = 0, normal = 0;
+    bool relative_vertex = false, relative_normal = false;
+    bool has_normal = false;
+  };
+
+  struct chunk {
+    const char *begin = nullptr, *end = nullptr;
+    std::vector<double> x, y, z, nx, ny, nz;
+    std::vector<corner> corners; // Three per triangle.
+    size_t lines = 0;
+    std::string error;
+    size_t error_line = 0;
+    int64_t vertex_base = 0, normal_base = 0; // Mesh indices of the first.
+  };
+
+  static int64_t resolve(int64_t index, bool relative, int64_t file_base,
+                         int64_t chunk_base) {
+    return (relative ? chunk_base : file_base) + index;
+  }
+
+  static void append(std::vector<double> &to,
+                     const std::vector<double> &from) {
+    to.insert(to.end(), from.begin(), from.end());
+  }
+
+  static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+  static const char *skip_space(const char *p, const char *end) {
+    while (p < end && is_space(*p))
+      p++;
+    return p;
+  }
+
+  static bool number(const char *&p, const char *end, double &out) {
+    p = skip_space(p, end);
+    if (p < end && *p == '+')
+      p++;
+    auto result = std::from_chars(p, end, out);
+    if (result.ec != std::errc())
+      return false;
+    p = result.ptr;
+    return true;
+  }
+
+  static bool integer(const char *&p, const char *end, int64_t &out) {
+    if (p < end && *p == '+')
+      p++;
+    auto result = std::from_chars(p, end, out);
+    if (result.ec != std::errc())
+      return false;
+    p = result.ptr;
+    return true;
+  }
+
+  // Reads an OBJ index (1-based, or negative counting back from the latest)
+  // as a 0-based absolute index or an offset from `defined`.
+  static bool index(const char *&p, const char *end, int64_t defined,
+                    int64_t &out, bool &relative) {
+    int64_t i;
+    if (!integer(p, end, i) || i == 0)
+      return false;
+    relative = i < 0;
+    out = relative ? defined + i : i - 1;
+    return true;
+  }
+
+  static void parse_chunk(chunk &c) {
+    std::vector<corner> face;
+    for (const char *line = c.begin; line < c.end;) {
+      const char *line_end = line;
+      while (line_end < c.end && *line_end != '\n')
+        line_end++;
+      const char *p = skip_space(line, line_end);
+      const char *next = line_end + 1;
+      c.lines++;
+
+      auto fail = [&](const char *message) {
+        c.error = message;
+        c.error_line = c.lines;
+      };
+
+      if (p + 1 < line_end && p[0] == 'v' && is_space(p[1])) {
+        double x, y, z;
+        p++;
+        if (!number(p, line_end, x) || !number(p, line_end, y) ||
+            !number(p, line_end, z))
+          return fail("expected: v x y z");
+        c.x.push_back(x);
+        c.y.push_back(y);
+        c.z.push_back(z);
+      } else if (p + 2 < line_end && p[0] == 'v' && p[1] == 'n' &&
+                 is_space(p[2])) {
+        double x, y, z;
+        p += 2;
+        if (!number(p, line_end, x) || !number(p, line_end, y) ||
+            !number(p, line_end, z))
+          return fail("expected: vn x y z");
+        c.nx.push_back(x);
+        c.ny.push_back(y);
+        c.nz.push_back(z);
+      } else if (p + 1 < line_end && p[0] == 'f' && is_space(p[1])) {
+        face.clear();
+        p = skip_space(p + 1, line_end);
+        while (p < line_end && *p != '#') {
+          corner at;
+          if (!index(p, line_end, int64_t(c.x.size()), at.vertex,
+                     at.relative_vertex))
+            return fail("bad face corner");
+          if (p < line_end && *p == '/') {
+            p++;
+            int64_t skipped; // Texture coordinate.
+            if (p < line_end && *p != '/' && !integer(p, line_end, skipped))
+              return fail("bad face corner");
+            if (p < line_end && *p == '/') {
+              p++;
+              if (!index(p, line_end, int64_t(c.nx.size()), at.normal,
+                         at.relative_normal))
+                return fail("bad face corner");
+              at.has_normal = true;
+            }
+          }
+          if (p < line_end && !is_space(*p))
+            return fail("bad face corner");
+          face.push_back(at);
+          p = skip_space(p, line_end);
+        }
+        if (face.size() < 3)
+          return fail("a face needs at least three corners");
+        for (size_t k = 1; k + 1 < face.size(); k++) {
+          c.corners.push_back(face[0]);
+          c.corners.push_back(face[k]);
+          c.corners.push_back(face[k + 1]);
+        }
+      }
+      line = next;
+    }
+  }
+};
+
+#endif // !OBJ_FILE_H
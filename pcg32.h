@@ -0,0 +1,55 @@
+#ifndef PCG32_H
+#define PCG32_H
+
+#include <cstdint>
+
+// Finalizer from splitmix64. Used to turn structured inputs (seed, pixel
+// index, sample index, dimension) into well mixed seeds.
+inline uint64_t mix_bits(uint64_t v) {
+  v ^= v >> 31;
+  v *= 0x7fb5d329728ea185ULL;
+  v ^= v >> 27;
+  v *= 0x81dadef4bc2dd44dULL;
+  v ^= v >> 33;
+  return v;
+}
+
+inline uint64_t hash_combine(uint64_t a, uint64_t b) {
+  return mix_bits(a ^ (mix_bits(b) + 0x9e3779b97f4a7c15ULL + (a << 6)));
+}
+
+// PCG32 (XSH-RR variant) by Melissa O'Neill. 16 bytes of state, a multiply and
+// a rotate per number, and 2^63 independent streams, so every pixel sample can
+// get a stream of its own.
+class pcg32 {
+public:
+  pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+  pcg32(uint64_t init_state, uint64_t init_seq = 1) {
+    seed(init_state, init_seq);
+  }
+
+  void seed(uint64_t init_state, uint64_t init_seq = 1) {
+    state = 0;
+    inc = (init_seq << 1) | 1;
+    next_uint();
+    state += init_state;
+    next_uint();
+  }
+
+  uint32_t next_uint() {
+    uint64_t old_state = state;
+    state = old_state * 6364136223846793005ULL + inc;
+    uint32_t xorshifted = uint32_t(((old_state >> 18) ^ old_state) >> 27);
+    uint32_t rot = uint32_t(old_state >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+  }
+
+  // Uniform double in [0, 1).
+  double next_double() { return next_uint() * 0x1p-32; }
+
+private:
+  uint64_t state;
+  uint64_t inc;
+};
+
+#endif // !PCG32_H
@@ -0,0 +1,275 @@
+#ifndef PROCESS_POOL_H
+#define PROCESS_POOL_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define PROCESS_POOL_FORK 1
+#endif
+
+// A pool of local worker processes that run jobs for a coordinator. The
+// workers are forked from the coordinator when the pool is built, so they
+// start with a copy of everything it has set up so far (the scene, the
+// camera) and a job only needs to carry what changes between jobs.
+//
+// Jobs and replies are byte strings sent over one Unix domain socket per
+// worker, each framed by its length. Every worker has at most one job at a
+// time. When a worker dies, its job goes back on the queue and a replacement
+// worker is forked in its place.
+//
+// Where fork is not available, or with num_workers < 1, jobs run in the
+// coordinator process instead.
+class process_pool {
+public:
+  using message = std::vector<unsigned char>;
+  using job_function = std::function<message(const message &)>;
+
+  // A job whose worker died this many times is given up on; the other jobs
+  // still run.
+  static constexpr int max_attempts = 3;
+
+  process_pool(int num_workers, job_function handler)
+      : handler(std::move(handler)) {
+#ifdef PROCESS_POOL_FORK
+    workers.resize(num_workers > 0 ? num_workers : 0);
+    for (size_t slot = 0; slot < workers.size(); slot++)
+      spawn(slot);
+#else
+    (void)num_workers;
+#endif
+  }
+
+  ~process_pool() {
+#ifdef PROCESS_POOL_FORK
+    // Closing a socket is the signal for its worker to exit.
+    for (auto &w : workers)
+      if (w.fd >= 0)
+        ::close(w.fd);
+    for (auto &w : workers)
+      if (w.pid > 0)
+        ::waitpid(w.pid, nullptr, 0);
+#endif
+  }
+
+  process_pool(const process_pool &) = delete;
+  process_pool &operator=(const process_pool &) = delete;
+
+  // Number of live workers; 0 when jobs run in this process.
+  int size() const {
+    int n = 0;
+    for (const auto &w : workers)
+      n += w.pid > 0;
+    return n;
+  }
+
+  // Runs every job and calls on_reply(job index, reply) in this process as
+  // the replies come in, in no particular order. Returns false if some job
+  // could not be finished, either because it kept killing its workers or
+  // because no worker could be started; on_reply has then been called for
+  // the jobs that did finish. A job that kills its workers only fails
+  // itself, while running out of workers abandons every job left.
+  bool run(const std::vector<message> &jobs,
+           const std::function<void(size_t, const message &)> &on_reply) {
+    if (size() == 0) {
+      for (size_t index = 0; index < jobs.size(); index++)
+        on_reply(index, handler(jobs[index]));
+      return true;
+    }
+#ifdef PROCESS_POOL_FORK
+    std::deque<size_t> queue;
+    for (size_t index = 0; index < jobs.size(); index++)
+      queue.push_back(index);
+    std::vector<int> attempts(jobs.size(), 0);
+    size_t finished = 0, failed = 0;
+
+    // A worker that died takes its job back to the front of the queue, or
+    // drops it once it has used up its attempts. False when no worker is
+    // left to run jobs.
+    auto lost = [&](size_t slot) {
+      long index = workers[slot].job;
+      kill_worker(slot);
+      if (index >= 0) {
+        if (++attempts[index] >= max_attempts)
+          failed++;
+        else
+          queue.push_front(size_t(index));
+      }
+      spawn(slot);
+      return size() > 0;
+    };
+
+    while (finished + failed < jobs.size()) {
+      for (size_t slot = 0; slot < workers.size() && !queue.empty(); slot++) {
+        auto &w = workers[slot];
+        if (w.pid <= 0 || w.job >= 0)
+          continue;
+        w.job = long(queue.front());
+        queue.pop_front();
+        if (!send_message(w.fd, jobs[w.job]) && !lost(slot))
+          return abandon();
+      }
+
+      std::vector<pollfd> fds;
+      std::vector<size_t> slots;
+      for (size_t slot = 0; slot < workers.size(); slot++) {
+        if (workers[slot].pid > 0 && workers[slot].job >= 0) {
+          fds.push_back({workers[slot].fd, POLLIN, 0});
+          slots.push_back(slot);
+        }
+      }
+      if (fds.empty())
+        return abandon();
+      if (::poll(fds.data(), fds.size(), -1) < 0) {
+        if (errno == EINTR)
+          continue;
+        return abandon();
+      }
+
+      for (size_t k = 0; k < fds.size(); k++) {
+        if (fds[k].revents == 0)
+          continue;
+        size_t slot = slots[k];
+        message reply;
+        if (!receive_message(workers[slot].fd, reply)) {
+          if (!lost(slot))
+            return abandon();
+          continue;
+        }
+        size_t index = size_t(workers[slot].job);
+        workers[slot].job = -1;
+        on_reply(index, reply);
+        finished++;
+      }
+    }
+    return failed == 0;
+#else
+    return true;
+#endif
+  }
+
+private:
+  struct worker {
+    int pid = -1;
+    int fd = -1;   // Coordinator end of the worker's socket.
+    long job = -1; // Index of the job in flight, if any.
+  };
+
+  job_function handler;
+  std::vector<worker> workers;
+
+#ifdef PROCESS_POOL_FORK
+  void spawn(size_t slot) {
+    int sockets[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+      return;
+    pid_t pid = ::fork();
+    if (pid < 0) {
+      ::close(sockets[0]);
+      ::close(sockets[1]);
+      return;
+    }
+    if (pid == 0) {
+      // Drop the coordinator ends of the other workers' sockets, or those
+      // workers would not see end of file when the coordinator closes them.
+      for (auto &w : workers)
+        if (w.fd >= 0)
+          ::close(w.fd);
+      ::close(sockets[0]);
+      worker_loop(sockets[1]);
+    }
+    ::close(sockets[1]);
+    workers[slot].pid = pid;
+    workers[slot].fd = sockets[0];
+    workers[slot].job = -1;
+  }
+
+  // Replaces the workers that still have a job in flight, so their replies
+  // do not turn up in the next run.
+  bool abandon() {
+    for (size_t slot = 0; slot < workers.size(); slot++) {
+      if (workers[slot].pid > 0 && workers[slot].job >= 0) {
+        kill_worker(slot);
+        spawn(slot);
+      }
+    }
+    return false;
+  }
+
+  void kill_worker(size_t slot) {
+    auto &w = workers[slot];
+    ::close(w.fd);
+    ::kill(w.pid, SIGKILL);
+    ::waitpid(w.pid, nullptr, 0);
+    w = worker();
+  }
+
+  // Never returns. _exit skips the coordinator's atexit handlers and stdio
+  // buffers, which the worker inherited but does not own.
+  [[noreturn]] void worker_loop(int fd) {
+    message job;
+    while (receive_message(fd, job))
+      if (!send_message(fd, handler(job)))
+        ::_exit(1);
+    ::_exit(0);
+  }
+
+  static bool send_all(int fd, const unsigned char *data, size_t n) {
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL; // A dead peer is an error, not a signal.
+#else
+    const int flags = 0;
+#endif
+    while (n > 0) {
+      ssize_t sent = ::send(fd, data, n, flags);
+      if (sent < 0 && errno == EINTR)
+        continue;
+      if (sent <= 0)
+        return false;
+      data += sent;
+      n -= size_t(sent);
+    }
+    return true;
+  }
+
+  static bool receive_all(int fd, unsigned char *data, size_t n) {
+    while (n > 0) {
+      ssize_t got = ::recv(fd, data, n, 0);
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got <= 0)
+        return false;
+      data += got;
+      n -= size_t(got);
+    }
+    return true;
+  }
+
+  static bool send_message(int fd, const message &m) {
+    uint64_t length = m.size();
+    return send_all(fd, reinterpret_cast<const unsigned char *>(&length),
+                    sizeof(length)) &&
+           send_all(fd, m.data(), m.size());
+  }
+
+  static bool receive_message(int fd, message &m) {
+    uint64_t length;
+    if (!receive_all(fd, reinterpret_cast<unsigned char *>(&length),
+                     sizeof(length)))
+      return false;
+    m.resize(length);
+    return receive_all(fd, m.data(), m.size());
+  }
+#endif
+};
+
+#endif // !PROCESS_POOL_H
@@ -13,7 +13,7 @@ public:
   const point3 &origin() const { return m_origin; }
   const vec3 &direction() const { return m_direction; }
 
-  point3 at(double t) const {
+  point3 at(real t) const {
     // P(t) = A + t*B, where A is the origin point and B is the direction vector
     return m_origin + t * m_direction;
   }
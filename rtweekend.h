@@ -4,16 +4,32 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <limits>
 #include <memory>
-#include <random>
+
+#include "pcg32.h"
 
 // C++ std usings
 
 using std::make_shared;
 using std::shared_ptr;
 
+// Scalar type of the math layer (vec3, ray, interval, color). Build with
+// -DRTWEEKEND_FLOAT for single precision, and additionally with
+// -DRTWEEKEND_SIMD for the SSE float4 vec3 (see vec3.h).
+
+#ifdef RTWEEKEND_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
+#if defined(RTWEEKEND_SIMD) && !defined(RTWEEKEND_FLOAT)
+#error "RTWEEKEND_SIMD is the float4 backend and needs RTWEEKEND_FLOAT"
+#endif
+
 // Constanta
 
 const double infinity = std::numeric_limits<double>::infinity();
@@ -25,12 +41,20 @@ inline double degrees_to_radians(double degrees) {
   return degrees * pi / 180.0;
 }
 
-inline double random_double() {
-  static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-  static std::mt19937 generator;
-  return distribution(generator);
+// Each thread owns its generator so renders on several threads neither race
+// on shared state nor depend on the order threads happen to draw numbers in.
+// The renderer reseeds it for every pixel sample (see sampler.h).
+inline pcg32 &random_generator() {
+  thread_local pcg32 generator;
+  return generator;
 }
 
+inline void seed_random(uint64_t seed, uint64_t stream = 1) {
+  random_generator().seed(seed, stream);
+}
+
+inline double random_double() { return random_generator().next_double(); }
+
 inline double random_double(double min, double max) {
   return min + (max - min) * random_double();
 }
@@ -41,5 +65,6 @@ inline double random_double(double min, double max) {
 #include "interval.h"
 #include "ray.h"
 #include "vec3.h"
+#include "warp.h"
 
 #endif // !RTWEEKEND_H
@@ -0,0 +1,192 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "arena.h"
+#include "rtweekend.h"
+
+#include <memory>
+
+// A sampler hands out the sample values for one pixel sample at a time, one
+// dimension (or pair of dimensions) per call: first the pixel jitter, then the
+// defocus lens, then whatever the bounces ask for through sample_1d() and
+// sample_2d() below (the built-in materials' directions, the light picked and
+// the point on it, Russian roulette). start_pixel_sample() also reseeds the
+// thread's random_double() stream, which other random choices (e.g. those of
+// user materials) draw from, so a pixel sample is a pure function of (seed,
+// pixel, sample index) and any pixel can be re-rendered on its own.
+class sampler {
+public:
+  sampler(uint64_t seed) : seed(seed) {}
+  virtual ~sampler() {
+    if (current() == this)
+      current() = nullptr;
+  }
+
+  virtual void start_pixel_sample(uint64_t pixel_index, int sample_index) {
+    pixel_seed = hash_combine(seed, pixel_index);
+    sample = uint32_t(sample_index);
+    dimension = 0;
+    seed_random(pixel_seed, sample_index);
+    current() = this;
+  }
+
+  // How far a pixel sample has got through its dimensions and the random
+  // stream, for renderers that trace many samples in turns (packets,
+  // wavefronts): saved when one sample stops and restored when it goes on,
+  // it draws exactly what the sample would have drawn without the break.
+  struct state {
+    uint64_t pixel_seed;
+    uint32_t sample;
+    uint32_t dimension;
+    pcg32 stream;
+  };
+
+  state save() const {
+    return {pixel_seed, sample, dimension, random_generator()};
+  }
+
+  void restore(const state &s) {
+    pixel_seed = s.pixel_seed;
+    sample = s.sample;
+    dimension = s.dimension;
+    random_generator() = s.stream;
+    current() = this;
+  }
+
+  // The sampler of the pixel sample this thread is tracing, if any.
+  static sampler *&current() {
+    thread_local sampler *active = nullptr;
+    return active;
+  }
+
+  // Uniform value in [0, 1).
+  virtual double get_1d() = 0;
+
+  // Uniform point in [0, 1)^2, returned in x and y with z = 0.
+  virtual vec3 get_2d() = 0;
+
+protected:
+  uint64_t seed;
+  uint64_t pixel_seed = 0;
+  uint32_t sample = 0;
+  uint32_t dimension = 0;
+};
+
+// Plain pseudo-random sampling from the per-sample PCG32 stream.
+class independent_sampler : public sampler {
+public:
+  independent_sampler(uint64_t seed) : sampler(seed) {}
+
+  double get_1d() override { return random_double(); }
+
+  vec3 get_2d() override {
+    auto x = random_double();
+    return vec3(x, random_double(), 0);
+  }
+};
+
+// Owen-scrambled Sobol points, following Burley, "Practical Hash-based Owen
+// Scrambling" (JCGT 2020). Every pair of dimensions is the first two Sobol
+// dimensions with an independent nested uniform scramble and a shuffled sample
+// order, so there is no limit on the number of dimensions and every pair is a
+// stratified (0,2)-sequence. Scramble seeds are per pixel, which decorrelates
+// neighbouring pixels.
+class sobol_sampler : public sampler {
+public:
+  sobol_sampler(uint64_t seed) : sampler(seed) {}
+
+  double get_1d() override {
+    uint32_t dim_seed = next_dimension_seed();
+    uint32_t index = nested_uniform_scramble(sample, dim_seed);
+    return to_unit(nested_uniform_scramble(reverse_bits(index),
+                                           hash_u32(dim_seed, 1)));
+  }
+
+  vec3 get_2d() override {
+    uint32_t dim_seed = next_dimension_seed();
+    uint32_t index = nested_uniform_scramble(sample, dim_seed);
+    auto x = to_unit(
+        nested_uniform_scramble(reverse_bits(index), hash_u32(dim_seed, 1)));
+    auto y = to_unit(
+        nested_uniform_scramble(sobol_dim1(index), hash_u32(dim_seed, 2)));
+    return vec3(x, y, 0);
+  }
+
+private:
+  uint32_t next_dimension_seed() {
+    return uint32_t(hash_combine(pixel_seed, dimension++));
+  }
+
+  static uint32_t hash_u32(uint32_t a, uint32_t b) {
+    return uint32_t(hash_combine(a, b));
+  }
+
+  static double to_unit(uint32_t v) { return v * 0x1p-32; }
+
+  static uint32_t reverse_bits(uint32_t v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+    v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+    return (v >> 16) | (v << 16);
+  }
+
+  // Second Sobol dimension. Its generator matrix is the Pascal matrix mod 2,
+  // whose columns are produced by v ^= v >> 1.
+  static uint32_t sobol_dim1(uint32_t index) {
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+      if (index & 1)
+        result ^= v;
+    return result;
+  }
+
+  // Laine-Karras style hash that only lets bits propagate upwards. Applied to
+  // bit-reversed values it is an Owen scramble.
+  static uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+  }
+
+  static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x = laine_karras_permutation(x, seed);
+    return reverse_bits(x);
+  }
+};
+
+// The next dimension (or pair) of the pixel sample this thread is tracing,
+// for the bounces. Outside a render, from the thread's random stream.
+inline double sample_1d() {
+  sampler *s = sampler::current();
+  return s ? s->get_1d() : random_double();
+}
+
+inline vec3 sample_2d() {
+  if (sampler *s = sampler::current())
+    return s->get_2d();
+  auto x = random_double();
+  return vec3(x, random_double(), 0);
+}
+
+enum class sampler_type { independent, sobol };
+
+inline std::unique_ptr<sampler> make_sampler(sampler_type type,
+                                             uint64_t seed) {
+  if (type == sampler_type::sobol)
+    return std::make_unique<sobol_sampler>(seed);
+  return std::make_unique<independent_sampler>(seed);
+}
+
+// Same, but placed in an arena, e.g. a thread's frame arena for one tile.
+inline sampler *make_sampler(sampler_type type, uint64_t seed, arena &a) {
+  if (type == sampler_type::sobol)
+    return a.create<sobol_sampler>(seed);
+  return a.create<independent_sampler>(seed);
+}
+
+#endif // !SAMPLER_H
@@ -0,0 +1,270 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "camera.h"
+#include "flat_bvh.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "scene_file.h"
+#include "sphere_soup.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+// Binary scene cache: a compiled sphere scene in the exact memory layout the
+// renderer traces, so opening one is an mmap and a few pointer assignments.
+// The file holds the sphere_soup arrays (centers, radii, material indices),
+// the material_record table, optionally the flat_bvh nodes over them, and
+// the camera settings as scene file text.
+//
+// With the nodes cached nothing is parsed, built or copied: the soup and the
+// tree read straight from the mapping, and pages are only loaded as rays
+// touch them. Without them the tree is built over the mapped spheres when
+// the cache is opened.
+//
+// A cache is tied to the build that wrote it (material_record holds reals,
+// and their size and layout change with RTWEEKEND_FLOAT and RTWEEKEND_SIMD)
+// and is not trusted: opening one checks its section sizes, the tree's
+// layout (see flat_bvh::valid_soup_nodes), every material index and every
+// record's kind, so a damaged or stale file is rejected instead of read out
+// of bounds. Sphere positions and the bounds are taken as they are.
+class scene_cache {
+public:
+  // Writes scene, which must have sphere_soup leaves with built-in materials
+  // only, and cam's settings. with_bvh also stores the tree.
+  static bool save(const std::string &path, const flat_bvh &scene,
+                   const camera &cam, bool with_bvh) {
+    const sphere_soup *soup = scene.sphere_leaves();
+    if (!soup)
+      return false;
+    auto arrays = soup->data();
+    for (size_t m = 0; m < arrays.material_count; m++)
+      if (arrays.records[m].type() == material_record::kind::other)
+        return false;
+
+    std::string settings = scene_file::camera_settings(cam);
+    header head = {};
+    std::memcpy(head.magic, magic, sizeof(head.magic));
+    head.version = version;
+    head.real_size = sizeof(real);
+    head.record_size = sizeof(material_record);
+    head.node_size = sizeof(flat_bvh_node);
+    head.sphere_lanes = arrays.count;
+    head.blocks = arrays.blocks;
+    head.material_count = arrays.material_count;
+    head.node_count = with_bvh ? scene.node_count() : 0;
+    auto bounds = scene.bounding_box();
+    for (int axis = 0; axis < 3; axis++) {
+      head.bounds[axis] = bounds.axis_interval(axis).min;
+      head.bounds[3 + axis] = bounds.axis_interval(axis).max;
+    }
+
+    size_t end = sizeof(header);
+    auto place = [&end](section &s, size_t bytes) {
+      s.offset = (end + alignment - 1) / alignment * alignment;
+      s.size = bytes;
+      end = s.offset + bytes;
+    };
+    size_t block_bytes = arrays.blocks * sizeof(double4);
+    place(head.center_x, block_bytes);
+    place(head.center_y, block_bytes);
+    place(head.center_z, block_bytes);
+    place(head.radii, block_bytes);
+    place(head.material_index, arrays.blocks * 4 * sizeof(uint32_t));
+    place(head.records, arrays.material_count * sizeof(material_record));
+    place(head.nodes, head.node_count * sizeof(flat_bvh_node));
+    place(head.camera_settings, settings.size());
+
+    auto file = mapped_file::create(path, end);
+    if (!file.is_open())
+      return false;
+    unsigned char *out = file.data();
+    std::memcpy(out, &head, sizeof(head));
+    std::memcpy(out + head.center_x.offset, arrays.center_x, block_bytes);
+    std::memcpy(out + head.center_y.offset, arrays.center_y, block_bytes);
+    std::memcpy(out + head.center_z.offset, arrays.center_z, block_bytes);
+    std::memcpy(out + head.radii.offset, arrays.radii, block_bytes);
+    std::memcpy(out + head.material_index.offset, arrays.material_index,
+                head.material_index.size);
+    // The records' material pointers mean nothing in another process.
+    for (size_t m = 0; m < arrays.material_count; m++) {
+      material_record r = arrays.records[m];
+      r.mat = nullptr;
+      std::memcpy(out + head.records.offset + m * sizeof(r), &r, sizeof(r));
+    }
+    if (head.node_count > 0)
+      std::memcpy(out + head.nodes.offset, scene.node_data(),
+                  head.nodes.size);
+    std::memcpy(out + head.camera_settings.offset, settings.data(),
+                settings.size());
+    return file.close();
+  }
+
+  // Whether path starts like a scene cache, as opposed to a text scene.
+  static bool is_cache(const std::string &path) {
+    std::FILE *in = std::fopen(path.c_str(), "rb");
+    if (!in)
+      return false;
+    char start[sizeof(magic)] = {};
+    bool match = std::fread(start, 1, sizeof(start), in) == sizeof(start) &&
+                 std::memcmp(start, magic, sizeof(start)) == 0;
+    std::fclose(in);
+    return match;
+  }
+
+  // Maps the cache at path and applies its camera settings to cam. The
+  // scene stays valid, and mapped, as long as this object lives.
+  bool open(const std::string &path, camera &cam, std::string &error) {
+    file = mapped_file::open_read(path);
+    if (!file.is_open()) {
+      error = path + ": cannot open";
+      return false;
+    }
+    header head;
+    if (uintptr_t(file.data()) % alignment != 0) {
+      error = path + ": mapping is not aligned";
+      return false;
+    }
+    if (file.size() < sizeof(head) ||
+        std::memcmp(file.data(), magic, sizeof(magic)) != 0) {
+      error = path + ": not a scene cache";
+      return false;
+    }
+    std::memcpy(&head, file.data(), sizeof(head));
+    if (head.version != version || head.real_size != sizeof(real) ||
+        head.record_size != sizeof(material_record) ||
+        head.node_size != sizeof(flat_bvh_node)) {
+      error = path + ": written by a different build, regenerate it";
+      return false;
+    }
+    // Counts too large for the file are rejected before any is multiplied
+    // by its element size, so none of the section sizes can wrap around.
+    if (!fits_count(head.sphere_lanes, sizeof(double)) ||
+        !fits_count(head.blocks, sizeof(double4)) ||
+        !fits_count(head.material_count, sizeof(material_record)) ||
+        !fits_count(head.node_count, sizeof(flat_bvh_node))) {
+      error = path + ": truncated or damaged";
+      return false;
+    }
+    size_t block_bytes = head.blocks * sizeof(double4);
+    if (head.blocks != (head.sphere_lanes + 3) / 4 ||
+        !fits(head.center_x, block_bytes) ||
+        !fits(head.center_y, block_bytes) ||
+        !fits(head.center_z, block_bytes) || !fits(head.radii, block_bytes) ||
+        !fits(head.material_index, head.blocks * 4 * sizeof(uint32_t)) ||
+        !fits(head.records, head.material_count * sizeof(material_record)) ||
+        !fits(head.nodes, head.node_count * sizeof(flat_bvh_node)) ||
+        !fits(head.camera_settings, head.camera_settings.size)) {
+      error = path + ": truncated or damaged";
+      return false;
+    }
+    if (!valid_contents(head)) {
+      error = path + ": damaged, regenerate it";
+      return false;
+    }
+
+    auto settings = reinterpret_cast<const char *>(
+        file.data() + head.camera_settings.offset);
+    if (!scene_file::load_camera(settings,
+                                 settings + head.camera_settings.size, cam,
+                                 error))
+      return false;
+
+    sphere_soup::arrays arrays;
+    arrays.center_x = at<double4>(head.center_x);
+    arrays.center_y = at<double4>(head.center_y);
+    arrays.center_z = at<double4>(head.center_z);
+    arrays.radii = at<double4>(head.radii);
+    arrays.material_index = at<uint32_t>(head.material_index);
+    arrays.records = at<material_record>(head.records);
+    arrays.blocks = head.blocks;
+    arrays.count = head.sphere_lanes;
+    arrays.material_count = head.material_count;
+    aabb bounds(point3(head.bounds[0], head.bounds[1], head.bounds[2]),
+                point3(head.bounds[3], head.bounds[4], head.bounds[5]));
+    auto soup = sphere_soup::borrow(arrays, bounds);
+
+    if (head.node_count > 0)
+      scene = std::make_unique<flat_bvh>(at<flat_bvh_node>(head.nodes),
+                                         head.node_count, std::move(soup),
+                                         bounds);
+    else
+      scene = std::make_unique<flat_bvh>(*soup);
+    return true;
+  }
+
+  const hittable &world() const { return *scene; }
+  flat_bvh &tree() { return *scene; }
+
+private:
+  static constexpr char magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', 0};
+  static constexpr uint32_t version = 1;
+  // Every section starts on a cache line, which is more than any array in
+  // it needs (double4 loads need 32 bytes).
+  static constexpr size_t alignment = 64;
+
+  struct section {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t real_size;
+    uint32_t record_size;
+    uint32_t node_size;
+    uint64_t sphere_lanes; // Including padding lanes, see sphere_soup.
+    uint64_t blocks;
+    uint64_t material_count;
+    uint64_t node_count; // 0 when the tree is not cached.
+    double bounds[6];    // Scene bounding box, min then max.
+    section center_x, center_y, center_z, radii;
+    section material_index, records, nodes, camera_settings;
+  };
+
+  static_assert(std::is_trivially_copyable<material_record>::value,
+                "material records are stored as raw bytes");
+
+  mapped_file file;
+  std::unique_ptr<flat_bvh> scene;
+
+  // Whether count elements of element_size bytes could be in the file.
+  bool fits_count(uint64_t count, size_t element_size) const {
+    return count <= file.size() / element_size;
+  }
+
+  bool fits(const section &s, size_t expected) const {
+    return s.size == expected && s.offset % alignment == 0 &&
+           s.offset <= file.size() && s.size <= file.size() - s.offset;
+  }
+
+  // The indices in the mapped sections, checked once here so traversal and
+  // shading can trust them. The sections must already fit.
+  bool valid_contents(const header &head) const {
+    const uint32_t *material_index = at<uint32_t>(head.material_index);
+    for (size_t i = 0; i < head.blocks * 4; i++)
+      if (material_index[i] >= head.material_count)
+        return false;
+    // Records from a cache have no material object to fall back on.
+    const unsigned char *records = file.data() + head.records.offset;
+    for (size_t m = 0; m < head.material_count; m++) {
+      material_record r;
+      std::memcpy(&r, records + m * sizeof(r), sizeof(r));
+      if (uint8_t(r.tag) >= uint8_t(material_record::kind::other))
+        return false;
+    }
+    return flat_bvh::valid_soup_nodes(at<flat_bvh_node>(head.nodes),
+                                      head.node_count, head.sphere_lanes);
+  }
+
+  template <typename T> const T *at(const section &s) const {
+    return reinterpret_cast<const T *>(file.data() + s.offset);
+  }
+};
+
+#endif // !SCENE_CACHE_H
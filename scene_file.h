@@ -0,0 +1,413 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "animation.h"
+#include "arena.h"
+#include "camera.h"
+#include "flat_bvh.h"
+#include "hittable_list.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "obj_file.h"
+#include "sphere.h"
+
+#include <charconv>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Text scene files. One statement per line, '#' starts a comment:
+//
+//   camera <field> <value...>           any field listed in camera_fields
+//   material <name> lambertian <r> <g> <b>
+//   material <name> metal <r> <g> <b> <fuzz>
+//   material <name> dielectric <refraction index>
+//   material <name> light <r> <g> <b>   emitted radiance, may exceed 1
+//   sphere <x> <y> <z> <radius> <material name>
+//   mesh <path to .obj file> <material name>
+//   camera_key <time> <lookfrom x y z> <lookat x y z> <vfov> <focus_dist>
+//   sphere_key <sphere> <time> <x y z>
+//
+// A material has to be defined before the objects that use it. A mesh path
+// is taken relative to the scene file's directory; the mesh gets a tree of
+// its own, which goes into the world as one object. Camera lines
+// set the public fields of camera with the same names, e.g.
+// `camera lookfrom 13 2 3` or `camera sampling sobol`; fields a file does not
+// mention keep whatever value the program gave them.
+//
+// The key lines describe an animation (see animation.h): camera keys make up
+// the camera path, and sphere keys move a sphere, counted from 0 in the
+// order of the file's sphere lines, to the given center at the given time.
+// Loading without an animation checks them and leaves them out.
+//
+// Numbers are written with enough digits to read back exactly, so a scene
+// saved and loaded again renders the same image.
+class scene_file {
+public:
+  // Reads the scene at path: spheres and materials are allocated in
+  // scene_arena and added to world, camera lines are applied to cam. On
+  // failure error holds "path:line: message" and world may hold part of the
+  // scene.
+  static bool load(const std::string &path, arena &scene_arena,
+                   hittable_list &world, camera &cam, std::string &error) {
+    animation unused;
+    return load(path, scene_arena, world, cam, unused, error);
+  }
+
+  // Also reads the camera and sphere keys into anim.
+  static bool load(const std::string &path, arena &scene_arena,
+                   hittable_list &world, camera &cam, animation &anim,
+                   std::string &error) {
+    auto file = mapped_file::open_read(path);
+    if (!file.is_open()) {
+      error = path + ": cannot open";
+      return false;
+    }
+    auto text = reinterpret_cast<const char *>(file.data());
+    return parse(text, text + file.size(), path, scene_arena, world, cam,
+                 anim, error);
+  }
+
+  // Applies camera lines (and only those) from text to cam.
+  static bool load_camera(const char *begin, const char *end, camera &cam,
+                          std::string &error) {
+    arena unused;
+    hittable_list no_spheres;
+    animation no_keys;
+    return parse(begin, end, "camera settings", unused, no_spheres, cam,
+                 no_keys, error);
+  }
+
+  // Writes world, which must hold only spheres with built-in materials, and
+  // cam's settings.
+  static bool save(const std::string &path, const hittable_list &world,
+                   const camera &cam) {
+    std::FILE *out = std::fopen(path.c_str(), "w");
+    if (!out)
+      return false;
+    std::string text = camera_settings(cam);
+    bool ok = std::fwrite(text.data(), 1, text.size(), out) == text.size();
+
+    std::unordered_map<const material *, size_t> names;
+    for (const auto &object : world.objects) {
+      auto *s = dynamic_cast<const sphere *>(object.get());
+      if (!s) {
+        ok = false;
+        break;
+      }
+      const material *mat = s->mat().get();
+      auto found = names.find(mat);
+      if (found == names.end()) {
+        found = names.emplace(mat, names.size()).first;
+        if (!write_material(out, found->second, material_record::from(mat))) {
+          ok = false;
+          break;
+        }
+      }
+      const point3 &c = s->center();
+      std::fprintf(out, "sphere %.17g %.17g %.17g %.17g m%zu\n", double(c.x()),
+                   double(c.y()), double(c.z()), double(s->radius()),
+                   found->second);
+    }
+    return (std::fclose(out) == 0) && ok;
+  }
+
+  // The camera lines for every field in camera_fields.
+  static std::string camera_settings(const camera &cam) {
+    std::string text;
+    char line[160];
+    for (const auto &field : camera_fields()) {
+      switch (field.type) {
+      case field_type::number:
+        std::snprintf(line, sizeof(line), "camera %s %.17g\n", field.name,
+                      cam.*field.number);
+        break;
+      case field_type::integer:
+        std::snprintf(line, sizeof(line), "camera %s %d\n", field.name,
+                      cam.*field.integer);
+        break;
+      case field_type::vector: {
+        const vec3 &v = cam.*field.vector;
+        std::snprintf(line, sizeof(line), "camera %s %.17g %.17g %.17g\n",
+                      field.name, double(v.x()), double(v.y()),
+                      double(v.z()));
+        break;
+      }
+      case field_type::flag:
+        std::snprintf(line, sizeof(line), "camera %s %d\n", field.name,
+                      int(cam.*field.flag));
+        break;
+      case field_type::sampling:
+        std::snprintf(line, sizeof(line), "camera %s %s\n", field.name,
+                      cam.sampling == sampler_type::sobol ? "sobol"
+                                                          : "independent");
+        break;
+      }
+      text += line;
+    }
+    return text;
+  }
+
+private:
+  enum class field_type { number, integer, vector, flag, sampling };
+
+  struct camera_field {
+    const char *name;
+    field_type type;
+    double camera::*number = nullptr;
+    int camera::*integer = nullptr;
+    vec3 camera::*vector = nullptr;
+    bool camera::*flag = nullptr;
+  };
+
+  // The camera settings a scene file can carry. Output paths and process
+  // settings (threads, workers) are left to the program.
+  static const std::vector<camera_field> &camera_fields() {
+    using t = field_type;
+    static const std::vector<camera_field> fields = {
+        {"aspect_ratio", t::number, &camera::aspect_ratio},
+        {"image_width", t::integer, nullptr, &camera::image_width},
+        {"samples_per_pixel", t::integer, nullptr, &camera::samples_per_pixel},
+        {"max_depth", t::integer, nullptr, &camera::max_depth},
+        {"vfov", t::number, &camera::vfov},
+        {"lookfrom", t::vector, nullptr, nullptr, &camera::lookfrom},
+        {"lookat", t::vector, nullptr, nullptr, &camera::lookat},
+        {"vup", t::vector, nullptr, nullptr, &camera::vup},
+        {"defocus_angle", t::number, &camera::defocus_angle},
+        {"focus_dist", t::number, &camera::focus_dist},
+        {"tile_size", t::integer, nullptr, &camera::tile_size},
+        {"sampling", t::sampling},
+        {"packet_primary", t::flag, nullptr, nullptr, nullptr,
+         &camera::packet_primary},
+        {"wavefront", t::flag, nullptr, nullptr, nullptr, &camera::wavefront},
+        {"russian_roulette", t::flag, nullptr, nullptr, nullptr,
+         &camera::russian_roulette},
+        {"roulette_min_depth", t::integer, nullptr,
+         &camera::roulette_min_depth},
+        {"light_sampling", t::flag, nullptr, nullptr, nullptr,
+         &camera::light_sampling},
+        {"sky_brightness", t::number, &camera::sky_brightness},
+    };
+    return fields;
+  }
+
+  // Whitespace separated tokens of one line.
+  struct line_reader {
+    const char *p, *end;
+
+    bool token(std::string &out) {
+      while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+      const char *start = p;
+      while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+        p++;
+      out.assign(start, p);
+      return p > start;
+    }
+
+    bool number(double &out) {
+      while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+      auto result = std::from_chars(p, end, out);
+      if (result.ec != std::errc())
+        return false;
+      p = result.ptr;
+      return true;
+    }
+
+    bool integer(int &out) {
+      double d;
+      // In range before converting: out-of-range (or NaN) conversions are
+      // undefined.
+      if (!number(d) || !(d >= std::numeric_limits<int>::min() &&
+                          d <= std::numeric_limits<int>::max()) ||
+          d != int(d))
+        return false;
+      out = int(d);
+      return true;
+    }
+
+    bool triple(color &out) {
+      double r, g, b;
+      if (!number(r) || !number(g) || !number(b))
+        return false;
+      out = color(r, g, b);
+      return true;
+    }
+
+    bool at_end() {
+      std::string rest;
+      return !token(rest);
+    }
+  };
+
+  static bool parse(const char *text, const char *text_end,
+                    const std::string &name, arena &scene_arena,
+                    hittable_list &world, camera &cam, animation &anim,
+                    std::string &error) {
+    std::unordered_map<std::string, shared_ptr<material>> materials;
+    std::vector<sphere *> spheres; // For sphere keys.
+    std::string word, material_name;
+    int line_number = 0;
+
+    for (const char *line = text; line < text_end;) {
+      const char *line_end = line;
+      while (line_end < text_end && *line_end != '\n')
+        line_end++;
+      const char *comment = line;
+      while (comment < line_end && *comment != '#')
+        comment++;
+      line_reader in{line, comment};
+      line = line_end + 1;
+      line_number++;
+
+      auto fail = [&](const std::string &message) {
+        error = name + ":" + std::to_string(line_number) + ": " + message;
+        return false;
+      };
+
+      if (!in.token(word))
+        continue;
+
+      if (word == "sphere") {
+        double x, y, z, radius;
+        if (!in.number(x) || !in.number(y) || !in.number(z) ||
+            !in.number(radius) || !in.token(material_name) || !in.at_end())
+          return fail("expected: sphere x y z radius material");
+        auto found = materials.find(material_name);
+        if (found == materials.end())
+          return fail("unknown material " + material_name);
+        auto s = scene_arena.make<sphere>(point3(x, y, z), radius,
+                                          found->second);
+        spheres.push_back(s.get());
+        world.add(s);
+      } else if (word == "mesh") {
+        std::string mesh_path;
+        if (!in.token(mesh_path) || !in.token(material_name) || !in.at_end())
+          return fail("expected: mesh path material");
+        auto found = materials.find(material_name);
+        if (found == materials.end())
+          return fail("unknown material " + material_name);
+        auto slash = name.find_last_of('/');
+        if (mesh_path[0] != '/' && slash != std::string::npos)
+          mesh_path = name.substr(0, slash + 1) + mesh_path;
+        triangle_mesh mesh(found->second);
+        std::string mesh_error;
+        if (!obj_file::load(mesh_path, mesh, mesh_error))
+          return fail(mesh_error);
+        world.add(scene_arena.make<flat_bvh>(mesh));
+      } else if (word == "material") {
+        std::string kind;
+        if (!in.token(material_name) || !in.token(kind))
+          return fail("expected: material name type parameters");
+        color albedo;
+        double value = 0;
+        shared_ptr<material> mat;
+        if (kind == "lambertian" && in.triple(albedo))
+          mat = scene_arena.make<lambertian>(albedo);
+        else if (kind == "metal" && in.triple(albedo) &&
+                 in.number(value))
+          mat = scene_arena.make<metal>(albedo, value);
+        else if (kind == "dielectric" && in.number(value))
+          mat = scene_arena.make<dielectric>(value);
+        else if (kind == "light" && in.triple(albedo))
+          mat = scene_arena.make<diffuse_light>(albedo);
+        if (!mat || !in.at_end())
+          return fail("bad material " + material_name);
+        materials[material_name] = mat;
+      } else if (word == "camera_key") {
+        double time, fov, focus;
+        point3 from, at;
+        if (!in.number(time) || !in.triple(from) || !in.triple(at) ||
+            !in.number(fov) || !in.number(focus) || !in.at_end())
+          return fail("expected: camera_key time lookfrom lookat vfov "
+                      "focus_dist");
+        anim.add_camera_key(time, from, at, fov, focus);
+      } else if (word == "sphere_key") {
+        int index;
+        double time;
+        point3 center;
+        if (!in.integer(index) || !in.number(time) || !in.triple(center) ||
+            !in.at_end())
+          return fail("expected: sphere_key sphere time x y z");
+        if (index < 0 || size_t(index) >= spheres.size())
+          return fail("no sphere " + std::to_string(index) + " yet");
+        anim.add_sphere_key(spheres[index], time, center);
+      } else if (word == "camera") {
+        if (!in.token(word) || !set_camera_field(in, word, cam) ||
+            !in.at_end())
+          return fail("bad camera setting " + word);
+      } else {
+        return fail("unknown statement " + word);
+      }
+    }
+    return true;
+  }
+
+  static bool set_camera_field(line_reader &in, const std::string &name,
+                               camera &cam) {
+    for (const auto &field : camera_fields()) {
+      if (name != field.name)
+        continue;
+      switch (field.type) {
+      case field_type::number:
+        return in.number(cam.*field.number);
+      case field_type::integer:
+        return in.integer(cam.*field.integer);
+      case field_type::vector:
+        return in.triple(cam.*field.vector);
+      case field_type::flag: {
+        int value;
+        if (!in.integer(value))
+          return false;
+        cam.*field.flag = value != 0;
+        return true;
+      }
+      case field_type::sampling: {
+        std::string value;
+        if (!in.token(value))
+          return false;
+        if (value == "sobol")
+          cam.sampling = sampler_type::sobol;
+        else if (value == "independent")
+          cam.sampling = sampler_type::independent;
+        else
+          return false;
+        return true;
+      }
+      }
+    }
+    return false;
+  }
+
+  static bool write_material(std::FILE *out, size_t index,
+                             const material_record &r) {
+    using kind = material_record::kind;
+    const color &a = r.albedo;
+    switch (r.type()) {
+    case kind::lambertian:
+      std::fprintf(out, "material m%zu lambertian %.17g %.17g %.17g\n", index,
+                   double(a.x()), double(a.y()), double(a.z()));
+      return true;
+    case kind::metal:
+      std::fprintf(out, "material m%zu metal %.17g %.17g %.17g %.17g\n",
+                   index, double(a.x()), double(a.y()), double(a.z()),
+                   r.param);
+      return true;
+    case kind::dielectric:
+      std::fprintf(out, "material m%zu dielectric %.17g\n", index, r.param);
+      return true;
+    case kind::light:
+      std::fprintf(out, "material m%zu light %.17g %.17g %.17g\n", index,
+                   double(a.x()), double(a.y()), double(a.z()));
+      return true;
+    case kind::other:
+      break;
+    }
+    return false;
+  }
+};
+
+#endif // !SCENE_FILE_H
@@ -0,0 +1,72 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "arena.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+
+// The final scene of the first book: a field of small random spheres around
+// three big ones. The random choices come from random_double(), so seed it
+// first for a reproducible scene. Everything is allocated in scene_arena.
+inline hittable_list book_final_scene(arena &scene_arena) {
+  hittable_list world;
+
+  auto ground_material = scene_arena.make<lambertian>(color(0.5, 0.5, 0.5));
+  world.add(
+      scene_arena.make<sphere>(point3(0, -1000, 0), 1000, ground_material));
+
+  for (int a = -11; a < 11; a++) {
+    for (int b = -11; b < 11; b++) {
+      auto choose_mat = random_double();
+      point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+      if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+        shared_ptr<material> sphere_material;
+
+        if (choose_mat < 0.8) {
+          // diffuse
+          auto albedo = color::random() * color::random();
+          sphere_material = scene_arena.make<lambertian>(albedo);
+          world.add(scene_arena.make<sphere>(center, 0.2, sphere_material));
+        } else if (choose_mat < 0.95) {
+          // metal
+          auto albedo = color::random(0.5, 1);
+          auto fuzz = random_double(0, 0.5);
+          sphere_material = scene_arena.make<metal>(albedo, fuzz);
+          world.add(scene_arena.make<sphere>(center, 0.2, sphere_material));
+        } else {
+          // glass
+          sphere_material = scene_arena.make<dielectric>(1.5);
+          world.add(scene_arena.make<sphere>(center, 0.2, sphere_material));
+        }
+      }
+    }
+  }
+
+  auto material1 = scene_arena.make<dielectric>(1.5);
+  world.add(scene_arena.make<sphere>(point3(0, 1, 0), 1.0, material1));
+
+  auto material2 = scene_arena.make<lambertian>(color(0.4, 0.2, 0.1));
+  world.add(scene_arena.make<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+  auto material3 = scene_arena.make<metal>(color(0.7, 0.6, 0.5), 0.0);
+  world.add(scene_arena.make<sphere>(point3(4, 1, 0), 1.0, material3));
+
+  return world;
+}
+
+// The viewpoint the book renders the final scene from.
+inline void book_final_view(camera &cam) {
+  cam.aspect_ratio = 16.0 / 9.0;
+  cam.vfov = 20;
+  cam.lookfrom = point3(13, 2, 3);
+  cam.lookat = point3(0, 0, 0);
+  cam.vup = vec3(0, 1, 0);
+
+  cam.defocus_angle = 0.6;
+  cam.focus_dist = 10.0;
+}
+
+#endif // !SCENES_H
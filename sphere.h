@@ -3,18 +3,35 @@
 
 #include "hittable.h"
 #include "material.h"
+#include "trace_stats.h"
 #include <memory>
 
 class sphere : public hittable {
 public:
-  sphere(const point3 &center, double radius, shared_ptr<material> mat)
-      : center(center), radius(std::fmax(0, radius)), mat(mat) {}
+  sphere(const point3 &center, real radius, shared_ptr<material> mat)
+      : m_center(center), m_radius(std::fmax(0, radius)), m_mat(mat) {
+    auto rvec = vec3(m_radius, m_radius, m_radius);
+    bbox = aabb(center - rvec, center + rvec);
+  }
+
+  const point3 &center() const { return m_center; }
+  real radius() const { return m_radius; }
+  const shared_ptr<material> &mat() const { return m_mat; }
+
+  // Moves the sphere, e.g. between the frames of an animation. Trees built
+  // over it see the new position after a flat_bvh::refit().
+  void move_to(const point3 &center) {
+    m_center = center;
+    auto rvec = vec3(m_radius, m_radius, m_radius);
+    bbox = aabb(center - rvec, center + rvec);
+  }
 
   bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-    vec3 CQ = center - r.origin();
+    TRACE_STAT(trace_counters::local().primitive_tests++);
+    vec3 CQ = m_center - r.origin();
     auto a = r.direction().length_squared();
     auto h = dot(r.direction(), CQ);
-    auto c = CQ.length_squared() - radius * radius;
+    auto c = CQ.length_squared() - m_radius * m_radius;
     auto discriminant = h * h - a * c;
 
     // Cannot simplify further since dot product isn't associative
@@ -37,17 +54,35 @@ public:
 
     rec.t = root;
     rec.p = r.at(rec.t);
-    vec3 outward_normal = (rec.p - center) / radius;
+    vec3 outward_normal = (rec.p - m_center) / m_radius;
     rec.set_face_normal(r, outward_normal);
-    rec.mat = mat;
+    rec.mat = m_mat.get();
+    rec.record = nullptr;
 
     return true;
   }
 
+  bool occluded(const ray &r, interval ray_t) const override {
+    TRACE_STAT(trace_counters::local().primitive_tests++);
+    vec3 CQ = m_center - r.origin();
+    auto a = r.direction().length_squared();
+    auto h = dot(r.direction(), CQ);
+    auto c = CQ.length_squared() - m_radius * m_radius;
+    auto discriminant = h * h - a * c;
+    if (discriminant < 0)
+      return false;
+    auto sqrtd = std::sqrt(discriminant);
+    return ray_t.surrounds((h - sqrtd) / a) ||
+           ray_t.surrounds((h + sqrtd) / a);
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
 private:
-  point3 center;
-  double radius;
-  shared_ptr<material> mat;
+  point3 m_center;
+  real m_radius;
+  shared_ptr<material> m_mat;
+  aabb bbox;
 };
 
 #endif // !SPHERE_H
@@ -0,0 +1,383 @@
+#ifndef SPHERE_SOUP_H
+#define SPHERE_SOUP_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "trace_stats.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SPHERE_SOUP_AVX2 1
+#endif
+
+// Four doubles, aligned so one AVX register load fetches a whole lane group.
+struct alignas(32) double4 {
+  double v[4];
+};
+
+// A set of spheres stored as a structure of arrays: centers, radii and
+// material indices each live in their own 32-byte aligned array, grouped in
+// blocks of four lanes. A ray is tested against a whole block at once, with
+// AVX2 when the CPU has it (checked once at runtime) and a scalar loop
+// otherwise. Only the nearest hit gets its normal and material filled in.
+//
+// Unused lanes at the end of a block hold NaN centers, which never hit.
+//
+// The kernels read the arrays through plain pointers, which point either at
+// the soup's own vectors (filled by add()) or at arrays that live elsewhere,
+// such as a memory-mapped scene cache (see borrow() and scene_cache.h).
+class sphere_soup : public hittable {
+public:
+  sphere_soup() {}
+  sphere_soup(const sphere_soup &) = delete;
+  sphere_soup &operator=(const sphere_soup &) = delete;
+
+  // Every object in the list must be a sphere, see holds_only_spheres().
+  sphere_soup(const hittable_list &list) {
+    for (const auto &object : list.objects)
+      add(static_cast<const sphere &>(*object));
+  }
+
+  static bool holds_only_spheres(const hittable_list &list) {
+    for (const auto &object : list.objects)
+      if (!dynamic_cast<const sphere *>(object.get()))
+        return false;
+    return true;
+  }
+
+  // Appends a sphere and returns its index.
+  size_t add(const sphere &s) {
+    return add(s.center(), s.radius(), s.mat());
+  }
+
+  size_t add(const point3 &center, double radius, shared_ptr<material> mat) {
+    return add(center, radius, intern_material(mat));
+  }
+
+  // Appends a sphere with entry `material` of the material table, which must
+  // exist already, e.g. copied from another soup with share_materials().
+  size_t add(const point3 &center, double radius, uint32_t material) {
+    size_t index = count++;
+    if (index % 4 == 0) {
+      double4 empty = {{nan, nan, nan, nan}};
+      own_center_x.push_back(empty);
+      own_center_y.push_back(empty);
+      own_center_z.push_back(empty);
+      own_radii.push_back({{0, 0, 0, 0}});
+      own_material_index.insert(own_material_index.end(), 4, 0);
+      point_at_own_arrays();
+    }
+    lane(own_center_x, index) = center[0];
+    lane(own_center_y, index) = center[1];
+    lane(own_center_z, index) = center[2];
+    lane(own_radii, index) = radius;
+    own_material_index[index] = material;
+
+    auto rvec = vec3(radius, radius, radius);
+    bbox = aabb(bbox, aabb(center - rvec, center + rvec));
+    return index;
+  }
+
+  // Makes this soup's material table a copy of other's, so spheres can be
+  // added with other's material indices.
+  void share_materials(const sphere_soup &other) {
+    materials = other.materials;
+    own_records.assign(other.records, other.records + other.material_count);
+    material_lookup = other.material_lookup;
+    point_at_own_arrays();
+  }
+
+  // The arrays behind a soup, as stored in a scene cache. The center and
+  // radius arrays hold `blocks` double4s, material_index 4 * blocks entries,
+  // which index records.
+  struct arrays {
+    const double4 *center_x, *center_y, *center_z, *radii;
+    const uint32_t *material_index;
+    const material_record *records;
+    size_t blocks;
+    size_t count; // Lanes in use, including padding at leaf boundaries.
+    size_t material_count;
+  };
+
+  arrays data() const {
+    return {center_x,       center_y, center_z, radii,
+            material_index, records,  blocks(), count,
+            material_count};
+  }
+
+  // A soup over arrays it does not own, which must outlive it. Nothing is
+  // copied. The records must not need a material object (kind other).
+  static std::unique_ptr<sphere_soup> borrow(const arrays &a,
+                                             const aabb &bounds) {
+    auto soup = std::make_unique<sphere_soup>();
+    soup->center_x = a.center_x;
+    soup->center_y = a.center_y;
+    soup->center_z = a.center_z;
+    soup->radii = a.radii;
+    soup->material_index = a.material_index;
+    soup->records = a.records;
+    soup->count = a.count;
+    soup->material_count = a.material_count;
+    soup->bbox = bounds;
+    return soup;
+  }
+
+  // Sphere i, or false for an unused lane.
+  bool sphere_at(size_t i, point3 &center, double &radius,
+                 uint32_t &material) const {
+    if (std::isnan(lane(center_x, i)))
+      return false;
+    center = point3(lane(center_x, i), lane(center_y, i), lane(center_z, i));
+    radius = lane(radii, i);
+    material = material_index[i];
+    return true;
+  }
+
+  // Moves sphere i of a soup built with add(). The soup's bounding box only
+  // ever grows; flat_bvh::refit() keeps the tree's own bounds.
+  void set_center(size_t i, const point3 &center) {
+    lane(own_center_x, i) = center[0];
+    lane(own_center_y, i) = center[1];
+    lane(own_center_z, i) = center[2];
+    auto rvec = vec3(lane(radii, i), lane(radii, i), lane(radii, i));
+    bbox = aabb(bbox, aabb(center - rvec, center + rvec));
+  }
+
+  // Pads to the next block boundary so the next sphere added starts a new
+  // block, and returns its index. Used to give every BVH leaf whole blocks.
+  size_t start_block() {
+    count = (count + 3) & ~size_t(3);
+    return count;
+  }
+
+  size_t size() const { return count; }
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    return hit_range(r, 0, count, ray_t, rec);
+  }
+
+  // Tests spheres [first, first + n), where first is a multiple of 4.
+  bool hit_range(const ray &r, size_t first, size_t n, interval ray_t,
+                 hit_record &rec) const {
+    TRACE_STAT(trace_counters::local().primitive_tests += n);
+    size_t block_begin = first / 4;
+    size_t block_end = (first + n + 3) / 4;
+    long best;
+    double best_t = ray_t.max;
+
+#ifdef SPHERE_SOUP_AVX2
+    if (has_avx2())
+      best = nearest_avx2(r, block_begin, block_end, ray_t.min, best_t);
+    else
+#endif
+      best = nearest_scalar(r, block_begin, block_end, ray_t.min, best_t);
+
+    if (best < 0)
+      return false;
+
+    point3 center(lane(center_x, best), lane(center_y, best),
+                  lane(center_z, best));
+    rec.t = best_t;
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center) / lane(radii, best);
+    rec.set_face_normal(r, outward_normal);
+    rec.record = &records[material_index[best]];
+    rec.mat = rec.record->source();
+    return true;
+  }
+
+  bool occluded(const ray &r, interval ray_t) const override {
+    return occluded_range(r, 0, count, ray_t);
+  }
+
+  // Whether any of spheres [first, first + n) is hit, like hit_range.
+  bool occluded_range(const ray &r, size_t first, size_t n,
+                      interval ray_t) const {
+    TRACE_STAT(trace_counters::local().primitive_tests += n);
+    size_t block_begin = first / 4;
+    size_t block_end = (first + n + 3) / 4;
+    double t_max = ray_t.max;
+#ifdef SPHERE_SOUP_AVX2
+    if (has_avx2())
+      return nearest_avx2(r, block_begin, block_end, ray_t.min, t_max,
+                          true) >= 0;
+#endif
+    return nearest_scalar(r, block_begin, block_end, ray_t.min, t_max,
+                          true) >= 0;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+private:
+  static constexpr double nan = std::numeric_limits<double>::quiet_NaN();
+
+  // What the kernels read, see the class comment.
+  const double4 *center_x = nullptr, *center_y = nullptr, *center_z = nullptr;
+  const double4 *radii = nullptr;
+  const uint32_t *material_index = nullptr;
+  const material_record *records = nullptr; // Indexed by material_index.
+  size_t count = 0;
+  size_t material_count = 0;
+  aabb bbox;
+
+  // Storage of a soup built with add().
+  std::vector<double4> own_center_x, own_center_y, own_center_z, own_radii;
+  std::vector<uint32_t> own_material_index;
+  std::vector<shared_ptr<material>> materials;
+  std::vector<material_record> own_records; // Same order as materials.
+  std::unordered_map<const material *, uint32_t> material_lookup;
+
+  size_t blocks() const { return (count + 3) / 4; }
+
+  void point_at_own_arrays() {
+    center_x = own_center_x.data();
+    center_y = own_center_y.data();
+    center_z = own_center_z.data();
+    radii = own_radii.data();
+    material_index = own_material_index.data();
+    records = own_records.data();
+    material_count = own_records.size();
+  }
+
+  static double &lane(std::vector<double4> &a, size_t i) {
+    return a[i / 4].v[i % 4];
+  }
+  static double lane(const double4 *a, size_t i) { return a[i / 4].v[i % 4]; }
+
+  uint32_t intern_material(const shared_ptr<material> &mat) {
+    auto found = material_lookup.find(mat.get());
+    if (found != material_lookup.end())
+      return found->second;
+    auto index = uint32_t(materials.size());
+    materials.push_back(mat);
+    own_records.push_back(material_record::from(mat.get()));
+    material_lookup.emplace(mat.get(), index);
+    point_at_own_arrays();
+    return index;
+  }
+
+  // Both kernels do exactly the arithmetic of sphere::hit per lane, so they
+  // find the same roots. They return the index of the nearest sphere hit in
+  // (t_min, t_max) and lower t_max to its root, or return -1. With
+  // stop_at_any they return the first hit they come across instead.
+  long nearest_scalar(const ray &r, size_t block_begin, size_t block_end,
+                      double t_min, double &t_max,
+                      bool stop_at_any = false) const {
+    const point3 &o = r.origin();
+    const vec3 &d = r.direction();
+    auto a = d.length_squared();
+    long best = -1;
+
+    for (size_t b = block_begin; b < block_end; b++) {
+      for (int k = 0; k < 4; k++) {
+        auto cqx = center_x[b].v[k] - o[0];
+        auto cqy = center_y[b].v[k] - o[1];
+        auto cqz = center_z[b].v[k] - o[2];
+        auto rad = radii[b].v[k];
+        auto h = d[0] * cqx + d[1] * cqy + d[2] * cqz;
+        auto c = (cqx * cqx + cqy * cqy + cqz * cqz) - rad * rad;
+        auto discriminant = h * h - a * c;
+        if (!(discriminant >= 0))
+          continue;
+
+        auto sqrtd = std::sqrt(discriminant);
+        auto root = (h - sqrtd) / a;
+        if (!(t_min < root && root < t_max)) {
+          root = (h + sqrtd) / a;
+          if (!(t_min < root && root < t_max))
+            continue;
+        }
+        t_max = root;
+        best = long(b * 4 + k);
+        if (stop_at_any)
+          return best;
+      }
+    }
+    return best;
+  }
+
+#ifdef SPHERE_SOUP_AVX2
+  static bool has_avx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+  }
+
+  __attribute__((target("avx2"))) long
+  nearest_avx2(const ray &r, size_t block_begin, size_t block_end,
+               double t_min, double &t_max, bool stop_at_any = false) const {
+    const point3 &o = r.origin();
+    const vec3 &d = r.direction();
+    const double a_scalar = d.length_squared();
+
+    const __m256d ox = _mm256_set1_pd(o[0]);
+    const __m256d oy = _mm256_set1_pd(o[1]);
+    const __m256d oz = _mm256_set1_pd(o[2]);
+    const __m256d dx = _mm256_set1_pd(d[0]);
+    const __m256d dy = _mm256_set1_pd(d[1]);
+    const __m256d dz = _mm256_set1_pd(d[2]);
+    const __m256d a = _mm256_set1_pd(a_scalar);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d vt_min = _mm256_set1_pd(t_min);
+    const __m256d inf = _mm256_set1_pd(infinity);
+    long best = -1;
+
+    for (size_t b = block_begin; b < block_end; b++) {
+      __m256d cqx = _mm256_sub_pd(_mm256_load_pd(center_x[b].v), ox);
+      __m256d cqy = _mm256_sub_pd(_mm256_load_pd(center_y[b].v), oy);
+      __m256d cqz = _mm256_sub_pd(_mm256_load_pd(center_z[b].v), oz);
+      __m256d rad = _mm256_load_pd(radii[b].v);
+
+      __m256d h = _mm256_add_pd(
+          _mm256_add_pd(_mm256_mul_pd(dx, cqx), _mm256_mul_pd(dy, cqy)),
+          _mm256_mul_pd(dz, cqz));
+      __m256d len2 = _mm256_add_pd(
+          _mm256_add_pd(_mm256_mul_pd(cqx, cqx), _mm256_mul_pd(cqy, cqy)),
+          _mm256_mul_pd(cqz, cqz));
+      __m256d c = _mm256_sub_pd(len2, _mm256_mul_pd(rad, rad));
+      __m256d disc = _mm256_sub_pd(_mm256_mul_pd(h, h), _mm256_mul_pd(a, c));
+
+      __m256d has_roots = _mm256_cmp_pd(disc, zero, _CMP_GE_OQ);
+      if (_mm256_movemask_pd(has_roots) == 0)
+        continue;
+
+      const __m256d vt_max = _mm256_set1_pd(t_max);
+      __m256d sqrtd = _mm256_sqrt_pd(disc);
+      __m256d near_root = _mm256_div_pd(_mm256_sub_pd(h, sqrtd), a);
+      __m256d far_root = _mm256_div_pd(_mm256_add_pd(h, sqrtd), a);
+      __m256d near_ok =
+          _mm256_and_pd(_mm256_cmp_pd(vt_min, near_root, _CMP_LT_OQ),
+                        _mm256_cmp_pd(near_root, vt_max, _CMP_LT_OQ));
+      __m256d far_ok =
+          _mm256_and_pd(_mm256_cmp_pd(vt_min, far_root, _CMP_LT_OQ),
+                        _mm256_cmp_pd(far_root, vt_max, _CMP_LT_OQ));
+      __m256d root = _mm256_blendv_pd(far_root, near_root, near_ok);
+      __m256d ok = _mm256_and_pd(has_roots, _mm256_or_pd(near_ok, far_ok));
+      if (_mm256_movemask_pd(ok) == 0)
+        continue;
+      if (stop_at_any)
+        return long(b * 4 + __builtin_ctz(_mm256_movemask_pd(ok)));
+
+      // Nearest valid root among the four lanes.
+      root = _mm256_blendv_pd(inf, root, ok);
+      __m256d m = _mm256_min_pd(root, _mm256_permute_pd(root, 0b0101));
+      m = _mm256_min_pd(m, _mm256_permute2f128_pd(m, m, 0x01));
+      int lanes = _mm256_movemask_pd(_mm256_cmp_pd(root, m, _CMP_EQ_OQ));
+
+      t_max = _mm256_cvtsd_f64(m);
+      best = long(b * 4 + __builtin_ctz(lanes));
+    }
+    return best;
+  }
+#endif
+};
+
+#endif // !SPHERE_SOUP_H
@@ -0,0 +1,152 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads with one job deque per worker. A worker
+// pops jobs from the back of its own deque and, once that runs dry, steals from
+// the front of the other workers' deques so that uneven jobs (e.g. a tile full
+// of glass next to a tile of sky) still keep every core busy.
+class thread_pool {
+public:
+  explicit thread_pool(int num_threads = 0) {
+    if (num_threads < 1)
+      num_threads = default_thread_count();
+
+    for (int i = 0; i < num_threads; i++)
+      queues.push_back(std::make_unique<work_queue>());
+    for (int i = 0; i < num_threads; i++)
+      workers.emplace_back([this, i] { worker_loop(i); });
+  }
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(state_mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  static int default_thread_count() {
+    int n = int(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+  }
+
+  int size() const { return int(workers.size()); }
+
+  // Index of the calling thread among the workers of the pool running it, or
+  // -1 when called from outside any pool.
+  static int worker_index() { return current_worker(); }
+
+  void submit(std::function<void()> job) {
+    // Jobs submitted from inside a worker go to that worker's own deque, where
+    // they are likely to run next while their data is still in cache. Jobs
+    // from outside the pool are dealt round-robin.
+    {
+      std::lock_guard<std::mutex> lock(state_mutex);
+      int target = (current_pool() == this)
+                       ? current_worker()
+                       : int(next_queue++ % queues.size());
+      {
+        std::lock_guard<std::mutex> queue_lock(queues[target]->mutex);
+        queues[target]->jobs.push_back(std::move(job));
+      }
+      queued++;
+      pending++;
+    }
+    wake.notify_one();
+  }
+
+  // Blocks until every job submitted so far has finished running.
+  void wait() {
+    std::unique_lock<std::mutex> lock(state_mutex);
+    done.wait(lock, [this] { return pending == 0; });
+  }
+
+private:
+  struct work_queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> jobs;
+  };
+
+  std::vector<std::unique_ptr<work_queue>> queues;
+  std::vector<std::thread> workers;
+  std::mutex state_mutex;
+  std::condition_variable wake; // Signalled when a job is queued or on stop.
+  std::condition_variable done; // Signalled when pending drops to zero.
+  size_t next_queue = 0;
+  int queued = 0;  // Jobs sitting in a deque.
+  int pending = 0; // Jobs queued or running.
+  bool stopping = false;
+
+  static int &current_worker() {
+    thread_local int index = -1;
+    return index;
+  }
+
+  static const thread_pool *&current_pool() {
+    thread_local const thread_pool *pool = nullptr;
+    return pool;
+  }
+
+  bool pop_local(int i, std::function<void()> &job) {
+    std::lock_guard<std::mutex> lock(queues[i]->mutex);
+    if (queues[i]->jobs.empty())
+      return false;
+    job = std::move(queues[i]->jobs.back());
+    queues[i]->jobs.pop_back();
+    return true;
+  }
+
+  bool steal(int i, std::function<void()> &job) {
+    int n = int(queues.size());
+    for (int k = 1; k < n; k++) {
+      auto &victim = *queues[(i + k) % n];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.jobs.empty()) {
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void worker_loop(int i) {
+    current_worker() = i;
+    current_pool() = this;
+
+    while (true) {
+      std::function<void()> job;
+      if (pop_local(i, job) || steal(i, job)) {
+        {
+          std::lock_guard<std::mutex> lock(state_mutex);
+          queued--;
+        }
+        job();
+        std::lock_guard<std::mutex> lock(state_mutex);
+        if (--pending == 0)
+          done.notify_all();
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(state_mutex);
+      wake.wait(lock, [this] { return stopping || queued > 0; });
+      if (stopping && queued == 0)
+        return;
+    }
+  }
+};
+
+#endif // !THREAD_POOL_H
@@ -0,0 +1,74 @@
+#ifndef TRACE_STATS_H
+#define TRACE_STATS_H
+
+#include <cstdint>
+#include <vector>
+
+// Opt-in instrumentation of the hot path. Building with -DRTWEEKEND_STATS
+// makes the intersection and scatter code count their work in per-thread
+// counters. The camera takes the difference of the calling thread's counters
+// around every tile, together with the tile's render time, and merges it into
+// the render's totals once per tile, so threads never write to shared
+// counters while tracing. After rendering it prints a summary and can write
+// JSON and a heatmap of the tile times (see camera::stats_json_path).
+//
+// Without the macro TRACE_STAT(...) expands to nothing, so none of this is
+// compiled into the hot path.
+#ifdef RTWEEKEND_STATS
+#define TRACE_STAT(statement) statement
+#else
+#define TRACE_STAT(statement)
+#endif
+
+struct trace_counters {
+  // Scatter calls are counted by material_record::kind.
+  static constexpr int material_kinds = 5;
+
+  uint64_t primitive_tests = 0; // Ray-primitive intersection tests.
+  uint64_t box_tests = 0;       // BVH node bounding box tests.
+  uint64_t material_hits[material_kinds] = {};
+
+  // This thread's counters. Only ever written by this thread.
+  static trace_counters &local() {
+    thread_local trace_counters counters;
+    return counters;
+  }
+
+  trace_counters operator-(const trace_counters &since) const {
+    trace_counters d;
+    d.primitive_tests = primitive_tests - since.primitive_tests;
+    d.box_tests = box_tests - since.box_tests;
+    for (int k = 0; k < material_kinds; k++)
+      d.material_hits[k] = material_hits[k] - since.material_hits[k];
+    return d;
+  }
+
+  void merge(const trace_counters &other) {
+    primitive_tests += other.primitive_tests;
+    box_tests += other.box_tests;
+    for (int k = 0; k < material_kinds; k++)
+      material_hits[k] += other.material_hits[k];
+  }
+};
+
+// What one render collected, merged from its tiles.
+struct trace_totals {
+  trace_counters counters;
+  std::vector<double> tile_seconds;   // By tile index, summed over passes.
+  std::vector<double> thread_seconds; // Time in tiles by pool worker index.
+  double tiles_seconds = 0;           // Wall time spent rendering tiles.
+
+  void add_tile(size_t tile, int thread, double seconds,
+                const trace_counters &tile_counters) {
+    counters.merge(tile_counters);
+    if (tile_seconds.size() <= tile)
+      tile_seconds.resize(tile + 1);
+    tile_seconds[tile] += seconds;
+    size_t slot = thread < 0 ? 0 : size_t(thread);
+    if (thread_seconds.size() <= slot)
+      thread_seconds.resize(slot + 1);
+    thread_seconds[slot] += seconds;
+  }
+};
+
+#endif // !TRACE_STATS_H
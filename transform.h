@@ -0,0 +1,142 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "aabb.h"
+#include "rtweekend.h"
+
+#include <cmath>
+
+// Affine transform p -> A p + b, stored as the 3x4 matrix [A | b]. Built
+// from translations, scales and rotations combined with operator*, where
+// (f * g) applies g first.
+class affine_transform {
+public:
+  affine_transform() {
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 4; j++)
+        m[i][j] = i == j ? 1 : 0;
+  }
+
+  static affine_transform translate(const vec3 &offset) {
+    affine_transform t;
+    for (int i = 0; i < 3; i++)
+      t.m[i][3] = offset[i];
+    return t;
+  }
+
+  static affine_transform scale(const vec3 &factors) {
+    affine_transform t;
+    for (int i = 0; i < 3; i++)
+      t.m[i][i] = factors[i];
+    return t;
+  }
+
+  static affine_transform scale(double factor) {
+    return scale(vec3(factor, factor, factor));
+  }
+
+  // Rotation by degrees counterclockwise about axis (Rodrigues' formula).
+  static affine_transform rotate(const vec3 &axis, double degrees) {
+    vec3 k = unit_vector(axis);
+    double theta = degrees_to_radians(degrees);
+    double c = std::cos(theta), s = std::sin(theta), t = 1 - c;
+    double x = k.x(), y = k.y(), z = k.z();
+    affine_transform r;
+    r.m[0][0] = t * x * x + c;
+    r.m[0][1] = t * x * y - s * z;
+    r.m[0][2] = t * x * z + s * y;
+    r.m[1][0] = t * x * y + s * z;
+    r.m[1][1] = t * y * y + c;
+    r.m[1][2] = t * y * z - s * x;
+    r.m[2][0] = t * x * z - s * y;
+    r.m[2][1] = t * y * z + s * x;
+    r.m[2][2] = t * z * z + c;
+    return r;
+  }
+
+  affine_transform operator*(const affine_transform &other) const {
+    affine_transform t;
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 4; j++) {
+        double sum = j == 3 ? m[i][3] : 0;
+        for (int k = 0; k < 3; k++)
+          sum += double(m[i][k]) * other.m[k][j];
+        t.m[i][j] = real(sum);
+      }
+    }
+    return t;
+  }
+
+  // The inverse, p -> A^-1 (p - b). A must not be singular.
+  affine_transform inverse() const {
+    double a[3][3];
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+        a[i][j] = m[i][j];
+    // Adjugate over determinant: column j of the inverse is the cross
+    // product of rows j + 1 and j + 2 of A.
+    double c[3][3];
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+        int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+        c[j][i] = a[i1][j1] * a[i2][j2] - a[i1][j2] * a[i2][j1];
+      }
+    }
+    double det = a[0][0] * c[0][0] + a[0][1] * c[1][0] + a[0][2] * c[2][0];
+    affine_transform t;
+    for (int i = 0; i < 3; i++) {
+      double offset = 0;
+      for (int j = 0; j < 3; j++) {
+        t.m[i][j] = real(c[i][j] / det);
+        offset -= c[i][j] / det * m[j][3];
+      }
+      t.m[i][3] = real(offset);
+    }
+    return t;
+  }
+
+  point3 apply_point(const point3 &p) const {
+    return apply_vector(p) + vec3(m[0][3], m[1][3], m[2][3]);
+  }
+
+  vec3 apply_vector(const vec3 &v) const {
+    return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+  }
+
+  // A^T v. For the inverse of a transform this maps normals the way the
+  // transform itself does (normals go with the inverse transpose), up to
+  // their length.
+  vec3 apply_transposed(const vec3 &v) const {
+    return vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+                m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+                m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+  }
+
+  // The smallest box enclosing the transformed box (Arvo, "Transforming
+  // Axis-Aligned Bounding Boxes", Graphics Gems 1990): each output axis
+  // takes the smaller and the larger product of every input axis.
+  aabb apply_box(const aabb &box) const {
+    if (box.is_empty())
+      return box;
+    interval out[3];
+    for (int i = 0; i < 3; i++) {
+      double lo = m[i][3], hi = m[i][3];
+      for (int j = 0; j < 3; j++) {
+        const interval &in = box.axis_interval(j);
+        double a = m[i][j] * in.min, b = m[i][j] * in.max;
+        lo += a < b ? a : b;
+        hi += a < b ? b : a;
+      }
+      out[i] = interval(lo, hi);
+    }
+    return aabb(out[0], out[1], out[2]);
+  }
+
+private:
+  real m[3][4];
+};
+
+#endif // !TRANSFORM_H
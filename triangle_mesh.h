@@ -0,0 +1,401 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "hittable.h"
+#include "material.h"
+#include "sphere_soup.h"
+#include "trace_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TRIANGLE_MESH_AVX2 1
+#endif
+
+// Vertex positions and normals of a mesh as a structure of arrays, indexed
+// by the triangles' corners. Shared by a mesh and the copies of it that
+// flat_bvh builds in leaf order.
+struct mesh_buffers {
+  std::vector<double> x, y, z;    // Positions.
+  std::vector<double> nx, ny, nz; // Normals, if the mesh has any.
+};
+
+// A triangle mesh with one material. Each triangle refers to three shared
+// vertices, and optionally three shared normals that are interpolated for
+// shading; without them the flat geometric normal is used.
+//
+// For intersection the triangles are also kept like the spheres of a
+// sphere_soup: in blocks of four lanes, each lane holding a corner and the
+// two edges from it (the setup of the Moller-Trumbore test) in 32-byte
+// aligned arrays. A ray is tested against a whole block at once, with AVX2
+// when the CPU has it and a scalar loop otherwise, and only the nearest hit
+// gets its normal filled in. Unused lanes hold NaN corners, which never hit.
+//
+// A mesh on its own tests every triangle; build a flat_bvh over it to trace
+// large meshes.
+class triangle_mesh : public hittable {
+public:
+  static constexpr uint32_t no_normal = std::numeric_limits<uint32_t>::max();
+
+  explicit triangle_mesh(shared_ptr<material> mat = nullptr)
+      : buffers(std::make_shared<mesh_buffers>()) {
+    set_material(std::move(mat));
+  }
+
+  triangle_mesh(const triangle_mesh &) = delete;
+  triangle_mesh &operator=(const triangle_mesh &) = delete;
+
+  void set_material(shared_ptr<material> m) {
+    mat = std::move(m);
+    record = material_record::from(mat.get());
+  }
+
+  // Vertex and normal storage, e.g. for a loader to fill in bulk before
+  // adding triangles. Shared with the meshes of trees built over this one.
+  mesh_buffers &vertex_data() { return *buffers; }
+  const mesh_buffers &vertex_data() const { return *buffers; }
+
+  uint32_t add_vertex(const point3 &p) {
+    buffers->x.push_back(p.x());
+    buffers->y.push_back(p.y());
+    buffers->z.push_back(p.z());
+    return uint32_t(buffers->x.size() - 1);
+  }
+
+  uint32_t add_normal(const vec3 &n) {
+    buffers->nx.push_back(n.x());
+    buffers->ny.push_back(n.y());
+    buffers->nz.push_back(n.z());
+    return uint32_t(buffers->nx.size() - 1);
+  }
+
+  // Appends the triangle with vertices a, b and c (counterclockwise seen
+  // from the front) and returns its index. The normals are either all set or
+  // all no_normal.
+  size_t add_triangle(uint32_t a, uint32_t b, uint32_t c,
+                      uint32_t na = no_normal, uint32_t nb = no_normal,
+                      uint32_t nc = no_normal) {
+    std::vector<double4> *arrays[9] = {&v0x, &v0y, &v0z, &e1x, &e1y,
+                                       &e1z, &e2x, &e2y, &e2z};
+    size_t index = count++;
+    if (index % 4 == 0) {
+      double4 empty = {{nan, nan, nan, nan}};
+      for (auto *array : arrays)
+        array->push_back(empty);
+      corners.insert(corners.end(), 12, 0);
+      normal_corners.insert(normal_corners.end(), 12, no_normal);
+    }
+    const uint32_t corner[3] = {a, b, c}, normal[3] = {na, nb, nc};
+    std::copy(corner, corner + 3, &corners[3 * index]);
+    std::copy(normal, normal + 3, &normal_corners[3 * index]);
+
+    point3 p0 = vertex(a), p1 = vertex(b), p2 = vertex(c);
+    vec3 e1 = p1 - p0, e2 = p2 - p0;
+    const double values[9] = {p0.x(), p0.y(), p0.z(), e1.x(), e1.y(),
+                              e1.z(), e2.x(), e2.y(), e2.z()};
+    for (int k = 0; k < 9; k++)
+      lane(*arrays[k], index) = values[k];
+    bbox = aabb(bbox, triangle_box(p0, p1, p2));
+    return index;
+  }
+
+  // Makes room for n triangles in all, to save reallocation while a large
+  // mesh is added.
+  void reserve(size_t n) {
+    size_t blocks = (n + 3) / 4;
+    for (auto *array : {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z})
+      array->reserve(blocks);
+    corners.reserve(12 * blocks);
+    normal_corners.reserve(12 * blocks);
+  }
+
+  // Makes this mesh use other's vertices, normals and material, so that
+  // other's triangles can be added to it with add_triangle_of().
+  void share_buffers(const triangle_mesh &other) {
+    buffers = other.buffers;
+    set_material(other.mat);
+  }
+
+  // Appends triangle i of other, which shares this mesh's buffers.
+  size_t add_triangle_of(const triangle_mesh &other, size_t i) {
+    const uint32_t *c = &other.corners[3 * i];
+    const uint32_t *n = &other.normal_corners[3 * i];
+    return add_triangle(c[0], c[1], c[2], n[0], n[1], n[2]);
+  }
+
+  // Bounds of triangle i, or false for an unused lane.
+  bool triangle_bounds(size_t i, aabb &box) const {
+    if (std::isnan(lane(v0x, i)))
+      return false;
+    const uint32_t *c = &corners[3 * i];
+    box = triangle_box(vertex(c[0]), vertex(c[1]), vertex(c[2]));
+    return true;
+  }
+
+  // Pads to the next block boundary so the next triangle added starts a new
+  // block, and returns its index. Used to give every BVH leaf whole blocks.
+  size_t start_block() {
+    count = (count + 3) & ~size_t(3);
+    return count;
+  }
+
+  size_t size() const { return count; }
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    return hit_range(r, 0, count, ray_t, rec);
+  }
+
+  // Tests triangles [first, first + n), where first is a multiple of 4.
+  bool hit_range(const ray &r, size_t first, size_t n, interval ray_t,
+                 hit_record &rec) const {
+    TRACE_STAT(trace_counters::local().primitive_tests += n);
+    size_t block_begin = first / 4;
+    size_t block_end = (first + n + 3) / 4;
+    long best;
+    double best_t = ray_t.max;
+
+#ifdef TRIANGLE_MESH_AVX2
+    if (has_avx2())
+      best = nearest_avx2(r, block_begin, block_end, ray_t.min, best_t);
+    else
+#endif
+      best = nearest_scalar(r, block_begin, block_end, ray_t.min, best_t);
+
+    if (best < 0)
+      return false;
+
+    rec.t = best_t;
+    rec.p = r.at(rec.t);
+    vec3 e1(lane(e1x, best), lane(e1y, best), lane(e1z, best));
+    vec3 e2(lane(e2x, best), lane(e2y, best), lane(e2z, best));
+    vec3 full = cross(e1, e2);
+    // The geometric normal decides which face was hit, so front_face stays
+    // right where an interpolated normal would tilt past the ray.
+    rec.set_face_normal(r, unit_vector(full));
+    const uint32_t *normal = &normal_corners[3 * best];
+    if (normal[0] != no_normal) {
+      // Barycentric coordinates of the hit from the areas it splits the
+      // triangle into, for the interpolated shading normal, which is kept on
+      // the side of the face that was hit.
+      vec3 to_p = rec.p - point3(lane(v0x, best), lane(v0y, best),
+                                 lane(v0z, best));
+      double area = dot(full, full);
+      double u = dot(cross(to_p, e2), full) / area;
+      double v = dot(cross(e1, to_p), full) / area;
+      vec3 shading = (1 - u - v) * buffer_normal(normal[0]) +
+                     u * buffer_normal(normal[1]) +
+                     v * buffer_normal(normal[2]);
+      if (shading.length_squared() > 0) {
+        shading = unit_vector(shading);
+        rec.normal = dot(shading, rec.normal) < 0 ? -shading : shading;
+      }
+    }
+    rec.record = &record;
+    rec.mat = record.source();
+    return true;
+  }
+
+  bool occluded(const ray &r, interval ray_t) const override {
+    return occluded_range(r, 0, count, ray_t);
+  }
+
+  // Whether any of triangles [first, first + n) is hit, like hit_range.
+  bool occluded_range(const ray &r, size_t first, size_t n,
+                      interval ray_t) const {
+    TRACE_STAT(trace_counters::local().primitive_tests += n);
+    size_t block_begin = first / 4;
+    size_t block_end = (first + n + 3) / 4;
+    double t_max = ray_t.max;
+#ifdef TRIANGLE_MESH_AVX2
+    if (has_avx2())
+      return nearest_avx2(r, block_begin, block_end, ray_t.min, t_max,
+                          true) >= 0;
+#endif
+    return nearest_scalar(r, block_begin, block_end, ray_t.min, t_max,
+                          true) >= 0;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+private:
+  static constexpr double nan = std::numeric_limits<double>::quiet_NaN();
+
+  shared_ptr<mesh_buffers> buffers;
+  std::vector<uint32_t> corners;        // Three vertex indices per lane.
+  std::vector<uint32_t> normal_corners; // Three normal indices per lane.
+  std::vector<double4> v0x, v0y, v0z;   // First corner.
+  std::vector<double4> e1x, e1y, e1z;   // Second corner minus the first.
+  std::vector<double4> e2x, e2y, e2z;   // Third corner minus the first.
+  shared_ptr<material> mat;
+  material_record record;
+  size_t count = 0;
+  aabb bbox;
+
+  point3 vertex(uint32_t i) const {
+    return point3(buffers->x[i], buffers->y[i], buffers->z[i]);
+  }
+
+  vec3 buffer_normal(uint32_t i) const {
+    return vec3(buffers->nx[i], buffers->ny[i], buffers->nz[i]);
+  }
+
+  // The triangle's box, widened a little along any axis it lies flat in: a
+  // box of zero thickness would never pass the slab test.
+  static aabb triangle_box(const point3 &a, const point3 &b,
+                           const point3 &c) {
+    aabb box(aabb(a, b), aabb(c, c));
+    const real delta = 0.0001;
+    interval axes[3];
+    for (int i = 0; i < 3; i++) {
+      axes[i] = box.axis_interval(i);
+      if (axes[i].size() < delta)
+        axes[i] = axes[i].expand(delta);
+    }
+    return aabb(axes[0], axes[1], axes[2]);
+  }
+
+  static double &lane(std::vector<double4> &a, size_t i) {
+    return a[i / 4].v[i % 4];
+  }
+  static double lane(const std::vector<double4> &a, size_t i) {
+    return a[i / 4].v[i % 4];
+  }
+
+  // Moller-Trumbore, with the same arithmetic in both kernels so they find
+  // the same hits. They return the lane of the nearest hit in (t_min, t_max)
+  // and lower t_max to its distance, or return -1. With stop_at_any they
+  // return the first hit they come across instead.
+  long nearest_scalar(const ray &r, size_t block_begin, size_t block_end,
+                      double t_min, double &t_max,
+                      bool stop_at_any = false) const {
+    const point3 &o = r.origin();
+    const vec3 &d = r.direction();
+    long best = -1;
+
+    for (size_t b = block_begin; b < block_end; b++) {
+      for (int k = 0; k < 4; k++) {
+        double ax = e1x[b].v[k], ay = e1y[b].v[k], az = e1z[b].v[k];
+        double bx = e2x[b].v[k], by = e2y[b].v[k], bz = e2z[b].v[k];
+        // p = d x e2, det = e1 . p
+        double px = d[1] * bz - d[2] * by;
+        double py = d[2] * bx - d[0] * bz;
+        double pz = d[0] * by - d[1] * bx;
+        double det = ax * px + ay * py + az * pz;
+        double inv_det = 1 / det;
+        double sx = o[0] - v0x[b].v[k];
+        double sy = o[1] - v0y[b].v[k];
+        double sz = o[2] - v0z[b].v[k];
+        double u = (sx * px + sy * py + sz * pz) * inv_det;
+        // q = s x e1
+        double qx = sy * az - sz * ay;
+        double qy = sz * ax - sx * az;
+        double qz = sx * ay - sy * ax;
+        double v = (d[0] * qx + d[1] * qy + d[2] * qz) * inv_det;
+        double t = (bx * qx + by * qy + bz * qz) * inv_det;
+        // Written so NaNs (padding lanes, det of 0) fail every test.
+        if (u >= 0 && v >= 0 && u + v <= 1 && t > t_min && t < t_max) {
+          t_max = t;
+          best = long(b * 4 + k);
+          if (stop_at_any)
+            return best;
+        }
+      }
+    }
+    return best;
+  }
+
+#ifdef TRIANGLE_MESH_AVX2
+  static bool has_avx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+  }
+
+  // a0 b0 + a1 b1 + a2 b2, and a0 b0 - a1 b1 for cross products, on four
+  // lanes at once.
+  __attribute__((target("avx2"))) static __m256d
+  dot3(__m256d a0, __m256d a1, __m256d a2, __m256d b0, __m256d b1,
+       __m256d b2) {
+    return _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(a0, b0), _mm256_mul_pd(a1, b1)),
+        _mm256_mul_pd(a2, b2));
+  }
+
+  __attribute__((target("avx2"))) static __m256d
+  cross_term(__m256d a0, __m256d b0, __m256d a1, __m256d b1) {
+    return _mm256_sub_pd(_mm256_mul_pd(a0, b0), _mm256_mul_pd(a1, b1));
+  }
+
+  __attribute__((target("avx2"))) long
+  nearest_avx2(const ray &r, size_t block_begin, size_t block_end,
+               double t_min, double &t_max, bool stop_at_any = false) const {
+    const point3 &o = r.origin();
+    const vec3 &d = r.direction();
+    const __m256d ox = _mm256_set1_pd(o[0]);
+    const __m256d oy = _mm256_set1_pd(o[1]);
+    const __m256d oz = _mm256_set1_pd(o[2]);
+    const __m256d dx = _mm256_set1_pd(d[0]);
+    const __m256d dy = _mm256_set1_pd(d[1]);
+    const __m256d dz = _mm256_set1_pd(d[2]);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1);
+    const __m256d vt_min = _mm256_set1_pd(t_min);
+    const __m256d inf = _mm256_set1_pd(infinity);
+    long best = -1;
+
+    for (size_t b = block_begin; b < block_end; b++) {
+      __m256d ax = _mm256_load_pd(e1x[b].v);
+      __m256d ay = _mm256_load_pd(e1y[b].v);
+      __m256d az = _mm256_load_pd(e1z[b].v);
+      __m256d bx = _mm256_load_pd(e2x[b].v);
+      __m256d by = _mm256_load_pd(e2y[b].v);
+      __m256d bz = _mm256_load_pd(e2z[b].v);
+
+      __m256d px = cross_term(dy, bz, dz, by);
+      __m256d py = cross_term(dz, bx, dx, bz);
+      __m256d pz = cross_term(dx, by, dy, bx);
+      __m256d inv_det = _mm256_div_pd(one, dot3(ax, ay, az, px, py, pz));
+      __m256d sx = _mm256_sub_pd(ox, _mm256_load_pd(v0x[b].v));
+      __m256d sy = _mm256_sub_pd(oy, _mm256_load_pd(v0y[b].v));
+      __m256d sz = _mm256_sub_pd(oz, _mm256_load_pd(v0z[b].v));
+      __m256d u = _mm256_mul_pd(dot3(sx, sy, sz, px, py, pz), inv_det);
+      __m256d ok = _mm256_cmp_pd(u, zero, _CMP_GE_OQ);
+      if (_mm256_movemask_pd(ok) == 0)
+        continue;
+
+      __m256d qx = cross_term(sy, az, sz, ay);
+      __m256d qy = cross_term(sz, ax, sx, az);
+      __m256d qz = cross_term(sx, ay, sy, ax);
+      __m256d v = _mm256_mul_pd(dot3(dx, dy, dz, qx, qy, qz), inv_det);
+      __m256d t = _mm256_mul_pd(dot3(bx, by, bz, qx, qy, qz), inv_det);
+      const __m256d vt_max = _mm256_set1_pd(t_max);
+      __m256d uv = _mm256_add_pd(u, v);
+      ok = _mm256_and_pd(ok, _mm256_cmp_pd(v, zero, _CMP_GE_OQ));
+      ok = _mm256_and_pd(ok, _mm256_cmp_pd(uv, one, _CMP_LE_OQ));
+      ok = _mm256_and_pd(ok, _mm256_cmp_pd(t, vt_min, _CMP_GT_OQ));
+      ok = _mm256_and_pd(ok, _mm256_cmp_pd(t, vt_max, _CMP_LT_OQ));
+      if (_mm256_movemask_pd(ok) == 0)
+        continue;
+      if (stop_at_any)
+        return long(b * 4 + __builtin_ctz(_mm256_movemask_pd(ok)));
+
+      // Nearest hit among the four lanes.
+      t = _mm256_blendv_pd(inf, t, ok);
+      __m256d m = _mm256_min_pd(t, _mm256_permute_pd(t, 0b0101));
+      m = _mm256_min_pd(m, _mm256_permute2f128_pd(m, m, 0x01));
+      int lanes = _mm256_movemask_pd(_mm256_cmp_pd(t, m, _CMP_EQ_OQ));
+
+      t_max = _mm256_cvtsd_f64(m);
+      best = long(b * 4 + __builtin_ctz(lanes));
+    }
+    return best;
+  }
+#endif
+};
+
+#endif // !TRIANGLE_MESH_H
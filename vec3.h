@@ -2,21 +2,64 @@
 #define VEC3_H
 
 #include "rtweekend.h"
+
+#ifdef RTWEEKEND_SIMD
+#include <xmmintrin.h>
+#endif
+
+// With RTWEEKEND_SIMD, a vec3 is a 16-byte aligned float4 whose fourth lane is
+// padding, and the arithmetic, dot, cross, length and unit_vector below run
+// as SSE operations on all four lanes. The padding lane is never read back into a
+// result, so it may hold anything. Without it, a vec3 is three reals.
 class vec3 {
 public:
-  double e[3];
+#ifdef RTWEEKEND_SIMD
+  alignas(16) real e[4];
+#else
+  real e[3];
+#endif
 
   vec3() : e{0, 0, 0} {}
-  vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+  vec3(real e0, real e1, real e2) : e{e0, e1, e2} {}
 
-  double x() const { return e[0]; }
-  double y() const { return e[1]; }
-  double z() const { return e[2]; }
+  real x() const { return e[0]; }
+  real y() const { return e[1]; }
+  real z() const { return e[2]; }
 
   vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-  double operator[](int i) const { return e[i]; }
-  double &operator[](int i) { return e[i]; }
+  real operator[](int i) const { return e[i]; }
+  real &operator[](int i) { return e[i]; }
+
+#ifdef RTWEEKEND_SIMD
+  explicit vec3(__m128 v) { _mm_store_ps(e, v); }
+  __m128 simd() const { return _mm_load_ps(e); }
+
+  vec3 &operator+=(const vec3 &v) {
+    _mm_store_ps(e, _mm_add_ps(simd(), v.simd()));
+    return *this;
+  }
+
+  vec3 &operator*=(real t) {
+    _mm_store_ps(e, _mm_mul_ps(simd(), _mm_set1_ps(t)));
+    return *this;
+  }
 
+  // The squared length in the lowest lane. Adds the lanes in the scalar
+  // order (x + y) + z, so results match the scalar float build exactly.
+  __m128 length_squared_ss() const {
+    __m128 v = simd();
+    __m128 p = _mm_mul_ps(v, v);
+    __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2));
+    return _mm_add_ss(_mm_add_ss(p, y), z);
+  }
+
+  real length() const {
+    return _mm_cvtss_f32(_mm_sqrt_ss(length_squared_ss()));
+  }
+
+  real length_squared() const { return _mm_cvtss_f32(length_squared_ss()); }
+#else
   vec3 &operator+=(const vec3 &v) {
     e[0] += v.e[0];
     e[1] += v.e[1];
@@ -24,20 +67,21 @@ public:
     return *this;
   }
 
-  vec3 &operator*=(double t) {
+  vec3 &operator*=(real t) {
     e[0] *= t;
     e[1] *= t;
     e[2] *= t;
     return *this;
   }
 
-  vec3 &operator/=(double t) { return *this *= 1 / t; }
-
-  double length() const { return std::sqrt(length_squared()); }
+  real length() const { return std::sqrt(length_squared()); }
 
-  double length_squared() const {
+  real length_squared() const {
     return (e[0] * e[0]) + (e[1] * e[1]) + (e[2] * e[2]);
   }
+#endif
+
+  vec3 &operator/=(real t) { return *this *= 1 / t; }
 
   bool near_zero() const {
     auto s = 1e-8;
@@ -49,7 +93,7 @@ public:
     return vec3(random_double(), random_double(), random_double());
   }
 
-  static vec3 random(double min, double max) {
+  static vec3 random(real min, real max) {
     return vec3(random_double(min, max), random_double(min, max),
                 random_double(min, max));
   }
@@ -64,6 +108,42 @@ inline std::ostream &operator<<(std::ostream &out, const vec3 &v) {
   return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
+#ifdef RTWEEKEND_SIMD
+inline vec3 operator+(const vec3 &u, const vec3 &v) {
+  return vec3(_mm_add_ps(u.simd(), v.simd()));
+}
+
+inline vec3 operator-(const vec3 &u, const vec3 &v) {
+  return vec3(_mm_sub_ps(u.simd(), v.simd()));
+}
+
+inline vec3 operator*(const vec3 &u, const vec3 &v) {
+  return vec3(_mm_mul_ps(u.simd(), v.simd()));
+}
+
+inline vec3 operator*(real t, const vec3 &v) {
+  return vec3(_mm_mul_ps(_mm_set1_ps(t), v.simd()));
+}
+
+// Adds the lanes in the scalar order (x + y) + z, so results match the
+// scalar float build exactly.
+inline real dot(const vec3 &u, const vec3 &v) {
+  __m128 p = _mm_mul_ps(u.simd(), v.simd());
+  __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+  __m128 z = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2));
+  return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(p, y), z));
+}
+
+// u.yzx * v.zxy - u.zxy * v.yzx
+inline vec3 cross(const vec3 &u, const vec3 &v) {
+  __m128 a = u.simd(), b = v.simd();
+  __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 a_zxy = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+  __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 b_zxy = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+  return vec3(_mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx)));
+}
+#else
 inline vec3 operator+(const vec3 &u, const vec3 &v) {
   return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
@@ -76,15 +156,11 @@ inline vec3 operator*(const vec3 &u, const vec3 &v) {
   return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3 &v) {
+inline vec3 operator*(real t, const vec3 &v) {
   return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline vec3 operator*(const vec3 &v, double t) { return t * v; }
-
-inline vec3 operator/(const vec3 &v, double t) { return (1 / t) * v; }
-
-inline double dot(const vec3 &u, const vec3 &v) {
+inline real dot(const vec3 &u, const vec3 &v) {
   return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
 }
 
@@ -93,40 +169,29 @@ inline vec3 cross(const vec3 &u, const vec3 &v) {
               u.e[2] * v.e[0] - u.e[0] * v.e[2],
               u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
+#endif
 
-inline vec3 unit_vector(const vec3 &v) { return v / v.length(); }
-
-inline vec3 random_in_unit_disk() {
-  while (true) {
-    auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
-    if (p.length_squared() < 1) {
-      return p;
-    }
-  }
-}
+inline vec3 operator*(const vec3 &v, real t) { return t * v; }
 
-inline vec3 random_unit_vector() {
-  while (true) {
-    auto p = vec3::random(-1, 1);
-    auto lensq = p.length_squared();
-    if (1e-160 < lensq && lensq <= 1)
-      return p / sqrt(lensq);
-  }
-}
+inline vec3 operator/(const vec3 &v, real t) { return (1 / t) * v; }
 
-inline vec3 random_on_hemisphere(const vec3 &normal) {
-  vec3 unit_on_sphere = random_unit_vector();
-  if (dot(unit_on_sphere, normal) > 0.0)
-    return unit_on_sphere;
-  else
-    return -unit_on_sphere;
+#ifdef RTWEEKEND_SIMD
+// The length stays in a register: square root and reciprocal in the lowest
+// lane, then one broadcast multiply. Multiplying by the reciprocal, as
+// v / length does, keeps the result the same as the scalar float build.
+inline vec3 unit_vector(const vec3 &v) {
+  __m128 inv = _mm_div_ss(_mm_set_ss(1), _mm_sqrt_ss(v.length_squared_ss()));
+  return vec3(_mm_mul_ps(v.simd(), _mm_shuffle_ps(inv, inv, 0)));
 }
+#else
+inline vec3 unit_vector(const vec3 &v) { return v / v.length(); }
+#endif
 
 inline vec3 reflect(const vec3 &v, const vec3 &n) {
   return v - 2 * dot(v, n) * n;
 }
 
-inline vec3 refract(const vec3 &uv, const vec3 &n, double etai_over_etat) {
+inline vec3 refract(const vec3 &uv, const vec3 &n, real etai_over_etat) {
   auto cos_theta = std::fmin(dot(-uv, n), 1.0);
   vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
   vec3 r_out_parallel =